@@ -23,12 +23,26 @@
 #ifndef TOASTER_H
 #define TOASTER_H
 
+#include <stddef.h>
+
 #ifdef TOASTER_SHOW_LOG
 #include <stdio.h>
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define TOASTER_NOOP (void)0
 
+#define TOASTER_STR_(x) #x
+#define TOASTER_STR(x) TOASTER_STR_(x)
+
+/**
+ * name of a TEST site, mocks name their site after the call they mock
+ */
+#define TOASTER_SITE __FILE__ ":" TOASTER_STR(__LINE__)
+
 #define TOASTER_PRINTLN(format, ...) \
     fprintf(stderr, __FILE__ ":%d:" format "\n", __LINE__, ##__VA_ARGS__)
 
@@ -40,7 +54,9 @@
 
 #ifdef TOASTER
 #define TOASTER_INJECT_FAILURE(err, expr) \
-    if(0 != toaster_check()) {\
+    static const char *const toaster_site_ \
+        __attribute__((used, section("toaster_sites"))) = TOASTER_SITE; \
+    if(0 != toaster_check_site(toaster_site_)) {\
       if(!err) {\
         err = -1;\
       }\
@@ -68,13 +84,439 @@
 
 #define CHECK(err) __ ## err ## _test_check
 
+/**
+ * set errno from a mock's table of plausible errnos, first entry is the default
+ * @retval, the errno that was set
+ */
+#define TOASTER_ERRNO(errnos) \
+    toaster_errno(errnos, (int)(sizeof(errnos) / sizeof((errnos)[0])))
+
+enum toaster_action {
+    TOASTER_ACTION_FAIL,
+    TOASTER_ACTION_DELAY,
+    TOASTER_ACTION_THROW,
+};
+
+enum toaster_dist {
+    TOASTER_DIST_FIXED,
+    TOASTER_DIST_UNIFORM,
+    TOASTER_DIST_PARETO,
+};
+
+/**
+ * fixed: min_us
+ * uniform: between min_us and max_us
+ * pareto: scale min_us and shape alpha > 0, capped at max_us if it is larger than min_us
+ */
+struct toaster_latency {
+    enum toaster_dist dist;
+    long min_us;
+    long max_us;
+    double alpha;
+};
+
+/**
+ * a site whose end-to-end latency grows by this many times the injected delay is reported as amplified
+ */
+#define TOASTER_AMPLIFICATION 2.0
+
 int toaster_check(void);
+int toaster_check_site(const char *site);
+
+/**
+ * fires only if the counter runs out exactly here, every check after it passes
+ * @retval, -1 if the fault at `site` should be applied
+ */
+int toaster_check_once(const char *site);
+
+/**
+ * caller filters
+ * mocks pass their return address, TOASTER_CALLER, and only consume the counter when
+ * the call came from a module or function added here, checks without a caller always count
+ * ranges are resolved once, with dl_iterate_phdr for the executable segments of the module
+ * containing `addr`, and dladdr for the symbol size of `fn`, which for functions in the
+ * executable has to be exported with -rdynamic
+ * @retval 0, if the range was added
+ */
+#define TOASTER_CALLER __builtin_return_address(0)
+#define TOASTER_MAX_FILTERS 16
+int toaster_check_from(const char *site, const void *caller);
+int toaster_check_once_from(const char *site, const void *caller);
+int toaster_filter_module(const void *addr);
+int toaster_filter_function(const void *fn);
+void toaster_filter_clear(void);
+
+/**
+ * toaster_check_from for mocks of C calls, libc or the allocator, whose frames must not
+ * unwind, TOASTER_ACTION_THROW fails the check instead of calling the thrower
+ */
+int toaster_check_nothrow_from(const char *site, const void *caller);
+
+/**
+ * operation contexts
+ * async code runs one logical operation on whatever thread is free, so a context id is kept
+ * per thread and executors make the operation's id current around every step they run for it
+ * with contexts on, only checks made while the iteration's own id is current consume the
+ * counter, work left over from earlier iterations and unrelated work on the same threads pass
+ * every iteration has a new id, toaster_context_iteration, to begin its operation in
+ * @retval toaster_context_enter, the id it replaced on this thread
+ */
+void toaster_set_contexts(int on);
+unsigned long toaster_context_iteration(void);
+unsigned long toaster_context_current(void);
+unsigned long toaster_context_enter(unsigned long ctx);
+
+/**
+ * site registry
+ * TEST sites are kept in the toaster_sites section of their module, the executable and
+ * every dlopen'd plugin built with -DTOASTER add theirs when they are loaded, and drop
+ * them along with any reset hooks from the same module when they are unloaded
+ * plugins share the host's runtime when the host exports it with -rdynamic, a plugin
+ * that links its own copy of toaster.o then calls into the host's
+ */
+#define TOASTER_MAX_MODULES 64
+int toaster_register_sites(const char *const *start, const char *const *stop);
+void toaster_unload_module(const void *addr);
+int toaster_site_count(void);
+const char *toaster_site_at(int i);
+
+#ifdef TOASTER
+extern const char *const __start_toaster_sites[] __attribute__((weak, visibility("hidden")));
+extern const char *const __stop_toaster_sites[] __attribute__((weak, visibility("hidden")));
+
+static void __attribute__((constructor)) toaster_sites_load(void) {
+    if(__start_toaster_sites) {
+        toaster_register_sites(__start_toaster_sites, __stop_toaster_sites);
+    }
+}
+
+static void __attribute__((destructor)) toaster_sites_unload(void) {
+    if(__start_toaster_sites) {
+        toaster_unload_module(__start_toaster_sites);
+    }
+}
+#endif
+int toaster_errno(const int *errnos, int n);
 void toaster_set(int cnt);
 int toaster_get();
 void toaster_end(void);
+/**
+ * run the test with the counter set from `min` to `max`
+ * until it returns 0 without an injected failure
+ * @retval 0, if test returned 0
+ */
 int toaster_run_max(int max, int (*test)(void));
 int toaster_run_range(int min, int max, int (*test)(void));
 int toaster_run(int (*test)(void));
 
+/**
+ * `reset` runs before every iteration, mock layers register their per-iteration state here
+ */
+#define TOASTER_MAX_RESETS 16
+int toaster_on_reset(void (*reset)(void));
+
+/**
+ * `done` runs after every iteration with its counter and what the test returned,
+ * layers that collect per-iteration results register here, up to TOASTER_MAX_RESETS
+ */
+int toaster_on_done(void (*done)(int cnt, int err));
+
+/**
+ * marks the running iteration as failed, for invariant and leak checks that find what
+ * the test's return value does not show, toaster_budget_run_range ranks its site by it
+ * @retval toaster_failures, the marks so far
+ */
+void toaster_fail(const char *why);
+int toaster_failures(void);
+
+/**
+ * number of forked workers that split the iterations of a sweep, 0 for one per cpu
+ * @retval, the previous number
+ */
+int toaster_set_jobs(int jobs);
+
+/**
+ * coverage for forked children, called in every worker the runtime forks
+ * with libgcov linked, -coverage and -Wl,-u,__gcov_dump, the child drops the counts it
+ * inherited and dumps its own into $GCOV_PREFIX/toaster-worker.<pid>, on exit or from a
+ * fatal signal, and toaster_gcda merges the worker directories back into $GCOV_PREFIX
+ */
+void toaster_coverage_worker(void);
+
+/**
+ * like toaster_run_range, but each counter is rerun for every errno
+ * in the table of the first mock that fails
+ * @retval 0, if test returned 0 without an injected failure
+ */
+int toaster_run_errno_range(int min, int max, int (*test)(void));
+
+/**
+ * like toaster_run_range, but with the counter disarmed and `setup(i)` called
+ * before each iteration to configure what a layer injects instead
+ */
+int toaster_run_with(int min, int max, void (*setup)(int i), int (*test)(void));
+
+/**
+ * toaster_run_range and toaster_run_errno_range for a test that takes a context,
+ * what the C++ runners in toaster.hpp call
+ */
+int toaster_run_range_ctx(int min, int max, int (*test)(void *ctx), void *ctx);
+int toaster_run_errno_range_ctx(int min, int max, int (*test)(void *ctx), void *ctx);
+
+/**
+ * record an injection a layer made without the counter, so the sweep does not stop on it
+ */
+void toaster_injected(const char *site);
+
+/**
+ * @retval, the site the current iteration injected at first, NULL if it has not injected
+ */
+const char *toaster_injected_site(void);
+
+/**
+ * what an injection does, delays fire once at the counter instead of failing every check after it
+ * throws fire once as well, by calling the thrower, so cleanup that runs while unwinding passes
+ */
+void toaster_set_action(enum toaster_action action);
+
+/**
+ * called with the site by TOASTER_ACTION_THROW, a C++ function that throws, see toaster.hpp
+ * without one the injection fails the check instead
+ */
+void toaster_set_thrower(void (*thrower)(const char *site));
+
+/**
+ * latency for `site`, a NULL `site` sets the default for all sites
+ * @retval -1, with EINVAL for a pareto `alpha` that is not positive
+ */
+int toaster_set_latency(const char *site, const struct toaster_latency *lat);
+
+/**
+ * inject at every check with probability `p`, independently of the counter
+ */
+void toaster_set_probability(double p, unsigned seed);
+
+/**
+ * delay each check from `min` to `max` in turn and compare with an undelayed run
+ * @retval, number of sites that amplified their delay, -1 if the test failed
+ */
+int toaster_run_latency_range(int min, int max, int (*test)(void));
+
+/**
+ * virtual time, linked in from toaster_time.o
+ * while enabled clocks only move when the mocked sleeps and timeouts advance them,
+ * and they rewind to the same point before every iteration
+ */
+void toaster_vtime_enable(int on);
+int toaster_vtime_enabled(void);
+long long toaster_vtime_ns(void);
+void toaster_vtime_advance(long long ns);
+
+/**
+ * event loop faults, linked in from toaster_poll.o
+ * while faults are on every poll and epoll_wait is a toaster_check_once site for
+ * failing with EINTR, leaving out a ready event and reporting a spurious one,
+ * and epoll_ctl is a toaster_check site
+ * spurious epoll events are picked from up to TOASTER_POLL_MAX registrations
+ */
+#define TOASTER_POLL_MAX 256
+void toaster_poll_faults(int on);
+
+/**
+ * fake unix datagram sockets, linked in from toaster_net.o
+ * while enabled AF_UNIX SOCK_DGRAM sockets live in memory, bound paths never touch
+ * the filesystem and every forked worker has its own network
+ * a blocking receive on an empty socket fails with EAGAIN after TOASTER_NET_SPIN yields
+ */
+#define TOASTER_NET_FD_BASE 0x40000000
+#define TOASTER_NET_MAX_SOCKETS 64
+#define TOASTER_NET_SPIN 1000
+void toaster_net_fake(int on);
+
+/**
+ * datagram faults on the fake network, each enabled fault is a toaster_check_once
+ * site for every datagram sent
+ * reordered datagrams are delivered after the next one, or when the queue runs dry
+ */
+#define TOASTER_NET_DROP      (1 << 0)
+#define TOASTER_NET_DUPLICATE (1 << 1)
+#define TOASTER_NET_REORDER   (1 << 2)
+#define TOASTER_NET_TRUNCATE  (1 << 3)
+#define TOASTER_NET_FAULTS    0xf
+void toaster_net_faults(unsigned faults);
+
+/**
+ * disk full simulation, linked in from toaster_disk.o
+ * writes to regular files draw from a byte budget that refills before every iteration,
+ * a write that does not fit is cut short, the next one fails with ENOSPC, and so does
+ * the next fsync, fallocate is all or nothing
+ * a negative budget disables it
+ */
+void toaster_disk_budget(long long bytes);
+
+/**
+ * ENOSPC or EDQUOT
+ */
+void toaster_disk_errno(int err);
+
+/**
+ * run the test with budgets of `min`, `min + step`, ... `max` bytes until it passes
+ * without running out of disk
+ * @retval -1, with EINVAL for a negative `min`, `max` below it, or INT_MAX steps or more
+ */
+int toaster_disk_run_range(long long min, long long max, long long step, int (*test)(void));
+
+/**
+ * scatter gather truncation, linked in from toaster_iov.o
+ * with a `step` > 0 writev, readv, sendmsg on stream sockets and recvmsg are cut short at
+ * every `step` bytes into each iovec and at every iovec boundary, each point a
+ * toaster_check_once site, so the counter enumerates them in order
+ * a cut recvmsg on a datagram socket comes back with MSG_TRUNC, and recvmsg has a
+ * second site that drops its control buffer for MSG_CTRUNC
+ * 0 turns truncation off
+ */
+void toaster_iov_faults(size_t step);
+
+/**
+ * real resource limits, linked in from toaster_rlimit.o
+ * each iteration forks a child with the soft limit of `resource`, RLIMIT_NOFILE, RLIMIT_AS,
+ * RLIMIT_NPROC, RLIMIT_FSIZE, ..., set to `min`, `min + step`, ... `max`
+ * SIGXFSZ is ignored so writes past RLIMIT_FSIZE fail with EFBIG
+ * @retval, the first limit at which the test returned 0, -1 if it never did, or if an
+ * earlier child died on a signal or left more fds open than it started with
+ */
+long long toaster_rlimit_run_range(int resource, long long min, long long max, long long step,
+                                   int (*test)(void));
+
+/**
+ * threading primitives, linked in from toaster_thread.o
+ * while faults are on pthread_create, pthread_mutex_init, pthread_cond_init,
+ * pthread_attr_* and sem_* are toaster_check sites
+ * pthread_create fails with EAGAIN while `max` threads it started are alive, -1 for no limit
+ */
+void toaster_thread_faults(int on);
+void toaster_thread_limit(int max);
+int toaster_thread_live(void);
+
+/**
+ * io_uring faults, linked in from toaster_uring.o
+ * with TOASTER_URING_ERRORS liburing's submit and wait calls are toaster_check sites that
+ * return -EAGAIN, -EBUSY, ..., and every completion they hand out is a toaster_check_once
+ * site for an error result
+ * TOASTER_URING_SHORT adds a site that halves the result, only for rings doing byte I/O,
+ * the mocks cannot see the opcode, and half an fd or a poll mask is not a short count
+ * toaster_uring_cqe applies the same rewrite to a completion peeked without liburing
+ * @retval 1, if the completion was rewritten
+ */
+#define TOASTER_URING_ERRORS (1 << 0)
+#define TOASTER_URING_SHORT  (1 << 1)
+#define TOASTER_URING_FAULTS 0x3
+struct io_uring_cqe;
+void toaster_uring_faults(unsigned faults);
+int toaster_uring_cqe(struct io_uring_cqe *cqe);
+
+/**
+ * memory mapping faults, linked in from toaster_mmap.o
+ * while faults are on mmap, munmap, mremap and madvise are toaster_check sites
+ * mmap names its site after MAP_HUGETLB and MAP_POPULATE so fallbacks are swept separately
+ * mremap with MREMAP_MAYMOVE has a site where it refuses to move and can only grow in place
+ */
+void toaster_mmap_faults(int on);
+
+/**
+ * heap accounting and faults, linked in from toaster_malloc.o
+ * malloc, calloc, realloc, free and the aligned allocators keep a count of live bytes
+ * while faults are on every allocation is a toaster_check site that fails with ENOMEM
+ * @retval, live heap bytes, or -1 if toaster_malloc.o is not linked
+ */
+void toaster_malloc_faults(int on);
+long long toaster_heap_live(void);
+
+/**
+ * operator new and delete, linked in from toaster_new.o, replace every global form
+ * and keep their own count of live bytes, so they can be checked without toaster_malloc.o
+ * while faults are on every allocation is a toaster_check site, a failed one throws
+ * std::bad_alloc, or returns null from the nothrow forms
+ * @retval, live bytes from operator new, or -1 if toaster_new.o is not linked
+ */
+void toaster_new_faults(int on);
+long long toaster_new_live(void);
+
+/**
+ * bitmap kernels under the edge map, linked in from toaster_bitmap.o
+ * avx2 and sse2 where the cpu has them, picked at load, and a scalar fallback
+ * all of them skip the zero blocks first, a 64KB map with 64 edges is bucketed in about
+ * 1.5us with avx2, 3us with sse2 and 8us scalar, see make bench
+ * toaster_bitmap_classify buckets hit counts in place, 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+ * toaster_bitmap_new counts the bytes of map with a bucket seen lacks, and in edges
+ * the ones seen has never hit, toaster_bitmap_merge ors map into seen
+ * @retval toaster_bitmap_kernel, the kernel now in use, the one asked for or the widest
+ * below it the cpu has
+ */
+#define TOASTER_BITMAP_SCALAR 0
+#define TOASTER_BITMAP_SSE2 1
+#define TOASTER_BITMAP_AVX2 2
+int toaster_bitmap_kernel(int kernel);
+void toaster_bitmap_classify(unsigned char *map, size_t len);
+int toaster_bitmap_new(const unsigned char *map, const unsigned char *seen, size_t len, int *edges);
+void toaster_bitmap_merge(unsigned char *seen, const unsigned char *map, size_t len);
+
+/**
+ * edge coverage, linked in from toaster_edges.o and toaster_bitmap.o, for code built with
+ * -fsanitize-coverage=trace-pc, or trace-pc-guard with clang
+ * every iteration counts the edges it takes in a map of TOASTER_EDGE_MAP bytes, which
+ * is bucketed by hit count like AFL and merged into the sweep's map after the iteration
+ * the sweep's map is shared, the workers of a parallel sweep merge into the parent's
+ * the edges an injected iteration adds are the cleanup paths its failure took
+ * @retval toaster_edges_new, edges the last iteration added, toaster_edges_total, edges
+ * seen since toaster_edges_clear, toaster_edges_stale, iterations that added none
+ */
+#define TOASTER_EDGE_MAP (1 << 16)
+void toaster_edges_clear(void);
+const unsigned char *toaster_edges_map(void);
+int toaster_edges_new(void);
+int toaster_edges_total(void);
+int toaster_edges_stale(void);
+
+/**
+ * toaster_run_range under a wall clock budget of `ms`, linked in from toaster_budget.o
+ * with toaster_edges.o, for CI that cannot afford the full sweep
+ * a run with the counter out of reach counts the checks, an eighth of the counters
+ * spread over the range run next, then the neighbours of the counters whose file
+ * found the most new edges and failures per iteration, until the budget runs out
+ * iterations run in process, one at a time, whatever toaster_set_jobs says
+ * a failure is an iteration that returned an error without an injection, or one that
+ * a check marked with toaster_fail, like a broken invariant or a leak from toaster_lsan.o
+ * @retval 0, if no iteration failed, toaster_budget_report fills in what the run covered
+ */
+struct toaster_budget {
+    int counters;
+    int iterations;
+    int failures;
+    int edges;
+    int complete;
+    long long ms;
+};
+int toaster_budget_run_range(int min, int max, long long ms, int (*test)(void));
+void toaster_budget_report(struct toaster_budget *report);
+
+/**
+ * leak checks after every iteration, linked in from toaster_lsan.o, for tests built with
+ * -fsanitize=address, instead of running the sweep under valgrind
+ * only the leaks an iteration adds are reported, with the site it injected at
+ * defaults to the fast unwinder with short allocation stacks, aborts on memory errors
+ * so a forked worker dies of them, and suppresses leaks in the dynamic loader
+ * ASAN_OPTIONS, LSAN_OPTIONS and LSAN_OPTIONS=suppressions=<file> add to the defaults
+ * leaks are still there at exit, where lsan fails the process, forked workers skip that check
+ * @retval toaster_lsan_leaks, iterations that leaked, toaster_lsan_bytes, what they leaked,
+ * toaster_lsan_site, the site of the first of them, with those of parallel workers
+ */
+int toaster_lsan_leaks(void);
+long long toaster_lsan_bytes(void);
+const char *toaster_lsan_site(void);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif //TOASTER_H
@@ -0,0 +1,539 @@
+/**
+ * toaster.hpp
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TOASTER_HPP
+#define TOASTER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+#if __cplusplus > 202002L && __has_include(<expected>)
+#include <expected>
+#endif
+
+#include "toaster.h"
+
+/**
+ * header only C++17 layer over the C runtime
+ * runners are templated on the callable, which is inlined into the one function the
+ * runtime calls per iteration, and TOASTER_TRY checks its site with the same
+ * toaster_check_site call as TEST
+ */
+namespace toaster {
+
+namespace detail {
+
+/** 0 for a pass, from an int status or anything with has_value() */
+template <class R>
+int status(R &&r) {
+    if constexpr(std::is_integral_v<std::decay_t<R>>) {
+        return static_cast<int>(r);
+    } else {
+        return r.has_value() ? 0 : -1;
+    }
+}
+
+template <class F>
+int thunk(void *f) {
+    return status((*static_cast<F *>(f))());
+}
+
+template <class F>
+void *context(F &f) {
+    return const_cast<void *>(static_cast<const void *>(std::addressof(f)));
+}
+
+} // namespace detail
+
+/**
+ * toaster_run_range for a callable that returns an int status or an expected, functions are
+ * wrapped in a lambda since the runtime takes their context as a data pointer
+ * @retval 0, if the callable passed without an injected failure
+ */
+template <class F>
+int run(int min, int max, F &&f) {
+    if constexpr(std::is_function_v<std::remove_reference_t<F>>) {
+        return run(min, max, [&f] { return f(); });
+    } else {
+        return toaster_run_range_ctx(min, max, detail::thunk<std::remove_reference_t<F>>,
+                                     detail::context(f));
+    }
+}
+
+/** toaster_run_errno_range for a callable */
+template <class F>
+int run_errno(int min, int max, F &&f) {
+    if constexpr(std::is_function_v<std::remove_reference_t<F>>) {
+        return run_errno(min, max, [&f] { return f(); });
+    } else {
+        return toaster_run_errno_range_ctx(min, max, detail::thunk<std::remove_reference_t<F>>,
+                                           detail::context(f));
+    }
+}
+
+/**
+ * runs `f` when it goes out of scope unless dismissed, the cleanup a CHECK label does in C
+ */
+template <class F>
+class scope {
+public:
+    explicit scope(F f) noexcept(std::is_nothrow_move_constructible_v<F>)
+        : f_(std::move(f)) {}
+    scope(const scope &) = delete;
+    scope &operator=(const scope &) = delete;
+    ~scope() {
+        if(active_) {
+            f_();
+        }
+    }
+    void dismiss() noexcept {
+        active_ = false;
+    }
+
+private:
+    F f_;
+    bool active_ = true;
+};
+
+/**
+ * the error an injected TOASTER_TRY returns, specialize it for other error types
+ */
+template <class E>
+struct injected_error {
+    static E value() {
+        if constexpr(std::is_integral_v<E>) {
+            return E(-1);
+        } else if constexpr(std::is_same_v<E, std::errc>) {
+            return std::errc::io_error;
+        } else if constexpr(std::is_same_v<E, std::error_code>) {
+            return std::make_error_code(std::errc::io_error);
+        } else {
+            return E{};
+        }
+    }
+};
+
+/**
+ * the exception TOASTER_ACTION_THROW throws, specialize it for other exception types
+ */
+template <class E>
+struct injected_exception {
+    static E make(const char *site) {
+        if constexpr(std::is_same_v<E, std::system_error>) {
+            return std::system_error(std::make_error_code(std::errc::io_error), site ? site : "");
+        } else {
+            return E();
+        }
+    }
+};
+
+namespace detail {
+
+template <class E>
+void thrower(const char *site) {
+    throw injected_exception<E>::make(site);
+}
+
+
+} // namespace detail
+
+/**
+ * exception safety sweep, the check picked by the counter throws an E instead of failing
+ * after every iteration, thrown or not, `invariant()` has to hold and, with toaster_malloc.o
+ * or toaster_new.o linked, the heap has to be back where it started, which makes the basic
+ * guarantee, and
+ * with an invariant that compares against a copy taken before the call, the strong one
+ * `f` runs once before the sweep so lazily allocated state does not count as a leak
+ * iterations run in process whatever toaster_set_jobs says, a worker's broken invariant
+ * would only be seen by the worker
+ * @retval 0, if `f` finished without a throw before `max` and every invariant and leak
+ * check passed
+ */
+template <class E = std::bad_alloc, class F, class I>
+int run_throwing(int min, int max, F &&f, I &&invariant) {
+    int broken = 0;
+    int rv;
+    const auto body = [&]() -> int {
+        const long long heap = toaster_heap_live();
+        const long long news = toaster_new_live();
+        long long leaked;
+        try {
+            f();
+        } catch(const E &) {
+        }
+        if(!invariant()) {
+            TOASTER_LOG("invariant broken after unwinding");
+            broken = 1;
+        }
+        leaked = std::max(toaster_heap_live() - heap, toaster_new_live() - news);
+        if(leaked > 0) {
+            TOASTER_LOG("leaked %lld bytes after unwinding", leaked);
+            broken = 1;
+        }
+        /** an iteration that threw keeps the sweep going, and fails it if `max` runs out */
+        return toaster_injected_site() ? -1 : 0;
+    };
+    const int jobs = toaster_set_jobs(1);
+    toaster_end();
+    f();
+    toaster_set_thrower(detail::thrower<E>);
+    toaster_set_action(TOASTER_ACTION_THROW);
+    rv = run(min, max, body);
+    toaster_set_action(TOASTER_ACTION_FAIL);
+    toaster_set_thrower(nullptr);
+    toaster_set_jobs(jobs);
+    return broken ? -1 : rv;
+}
+
+/**
+ * pmr adaptor that checks `site` before every allocation it passes upstream, and counts what
+ * it has handed out, so arenas that preallocate from it are swept where they grow and checked
+ * for leaks with live()
+ */
+class failing_resource : public std::pmr::memory_resource {
+public:
+    explicit failing_resource(std::pmr::memory_resource *upstream = std::pmr::get_default_resource(),
+                              const char *site = "pmr") noexcept
+        : upstream_(upstream), site_(site) {}
+    failing_resource(const failing_resource &) = delete;
+    failing_resource &operator=(const failing_resource &) = delete;
+    /** bytes allocated and not yet deallocated */
+    long long live() const noexcept {
+        return live_;
+    }
+    long long allocations() const noexcept {
+        return allocations_;
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t align) override {
+        if(toaster_check_site(site_)) {
+            TOASTER_LOG("mock failure: %s", site_);
+            throw std::bad_alloc();
+        }
+        void *p = upstream_->allocate(bytes, align);
+        live_ += static_cast<long long>(bytes);
+        ++allocations_;
+        return p;
+    }
+    void do_deallocate(void *p, std::size_t bytes, std::size_t align) override {
+        upstream_->deallocate(p, bytes, align);
+        live_ -= static_cast<long long>(bytes);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource *upstream_;
+    const char *site_;
+    long long live_ = 0;
+    long long allocations_ = 0;
+};
+
+/**
+ * the logical operation checks on this thread are counted against, see toaster_set_contexts
+ * a default constructed context is the one current where it was made
+ */
+class context {
+public:
+    context() noexcept : id_(toaster_context_current()) {}
+    /** the operation the current iteration is swept in */
+    static context iteration() noexcept {
+        return context(toaster_context_iteration());
+    }
+    unsigned long id() const noexcept {
+        return id_;
+    }
+
+private:
+    explicit context(unsigned long id) noexcept : id_(id) {}
+    unsigned long id_;
+};
+
+/**
+ * makes a context current on this thread until it goes out of scope
+ */
+class context_guard {
+public:
+    explicit context_guard(context c) noexcept : prev_(toaster_context_enter(c.id())) {}
+    context_guard(const context_guard &) = delete;
+    context_guard &operator=(const context_guard &) = delete;
+    ~context_guard() {
+        toaster_context_enter(prev_);
+    }
+
+private:
+    unsigned long prev_;
+};
+
+/**
+ * wraps `f` to run in the context current where it was bound, for tasks posted to a pool
+ */
+template <class F>
+auto bind(F &&f) {
+    return [c = context(), f = std::forward<F>(f)](auto &&...args) mutable -> decltype(auto) {
+        context_guard guard(c);
+        return f(std::forward<decltype(args)>(args)...);
+    };
+}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+class context_promise;
+
+namespace detail {
+
+/** the awaiter of `a`, temporaries are moved in so they outlive the statement that made them */
+template <class A>
+decltype(auto) awaiter(A &&a) {
+    if constexpr(requires { std::forward<A>(a).operator co_await(); }) {
+        return std::forward<A>(a).operator co_await();
+    } else if constexpr(std::is_lvalue_reference_v<A>) {
+        return static_cast<A>(a);
+    } else {
+        return std::remove_cvref_t<A>(std::move(a));
+    }
+}
+
+/**
+ * takes the coroutine's context on whichever thread resumes it, and hands the thread back
+ * its own once the awaiter has scheduled the resumption, so tasks it posts are bound to the
+ * coroutine
+ */
+template <class T>
+struct in_context {
+    T awaiter;
+    context_promise *promise;
+    bool suspended = false;
+
+    bool await_ready() noexcept(noexcept(awaiter.await_ready())) {
+        return awaiter.await_ready();
+    }
+    template <class H>
+    auto await_suspend(H h) noexcept(noexcept(awaiter.await_suspend(h)));
+    decltype(auto) await_resume() noexcept(noexcept(awaiter.await_resume()));
+};
+
+/** hands the thread back its own context before the coroutine finishes */
+template <class T>
+struct leaving {
+    T awaiter;
+    context_promise *promise;
+
+    bool await_ready() noexcept(noexcept(awaiter.await_ready()));
+    template <class H>
+    decltype(auto) await_suspend(H h) noexcept(noexcept(awaiter.await_suspend(h))) {
+        return awaiter.await_suspend(h);
+    }
+    decltype(auto) await_resume() noexcept(noexcept(awaiter.await_resume())) {
+        return awaiter.await_resume();
+    }
+};
+
+} // namespace detail
+
+/**
+ * base for promise types whose coroutines keep the context they were created in
+ * every co_await in the body goes through await_transform, initial_suspend should return
+ * its awaiter through in_context, and final_suspend through leave
+ */
+class context_promise {
+public:
+    context_promise() noexcept : context_(toaster_context_current()), resumed_from_(context_) {}
+    template <class A>
+    auto in_context(A &&a) noexcept(noexcept(detail::awaiter(std::forward<A>(a)))) {
+        return detail::in_context<decltype(detail::awaiter(std::forward<A>(a)))>{
+            detail::awaiter(std::forward<A>(a)), this};
+    }
+    template <class A>
+    auto leave(A &&a) noexcept(noexcept(detail::awaiter(std::forward<A>(a)))) {
+        return detail::leaving<decltype(detail::awaiter(std::forward<A>(a)))>{
+            detail::awaiter(std::forward<A>(a)), this};
+    }
+    template <class A>
+    auto await_transform(A &&a) noexcept(noexcept(in_context(std::forward<A>(a)))) {
+        return in_context(std::forward<A>(a));
+    }
+
+private:
+    template <class T>
+    friend struct detail::in_context;
+    template <class T>
+    friend struct detail::leaving;
+    unsigned long context_;
+    unsigned long resumed_from_;
+};
+
+/** once the resumption is scheduled the frame may already be running, or gone, elsewhere */
+template <class T>
+template <class H>
+auto detail::in_context<T>::await_suspend(H h) noexcept(noexcept(awaiter.await_suspend(h))) {
+    const unsigned long prev = promise->resumed_from_;
+    suspended = true;
+    if constexpr(std::is_void_v<decltype(awaiter.await_suspend(h))>) {
+        awaiter.await_suspend(h);
+        toaster_context_enter(prev);
+    } else {
+        auto rv = awaiter.await_suspend(h);
+        toaster_context_enter(prev);
+        return rv;
+    }
+}
+
+template <class T>
+decltype(auto) detail::in_context<T>::await_resume() noexcept(noexcept(awaiter.await_resume())) {
+    if(suspended) {
+        promise->resumed_from_ = toaster_context_enter(promise->context_);
+    }
+    return awaiter.await_resume();
+}
+
+template <class T>
+bool detail::leaving<T>::await_ready() noexcept(noexcept(awaiter.await_ready())) {
+    toaster_context_enter(promise->resumed_from_);
+    return awaiter.await_ready();
+}
+#endif
+
+/**
+ * FNV-1a of a site name, TOASTER_SITE_ID hashes the file, line and expression of a site
+ */
+constexpr std::uint64_t site_id(std::string_view name) noexcept {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for(char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * injection plans, TOASTER_TEST and TOASTER_TRY only check the sites their plan targets
+ * and every other site compiles to the plain test, the default plan targets all of them
+ */
+template <std::uint64_t... Ids>
+struct plan {
+    static constexpr bool targets(std::uint64_t id) noexcept {
+        return ((id == Ids) || ...);
+    }
+};
+
+struct every_site {
+    static constexpr bool targets(std::uint64_t) noexcept {
+        return true;
+    }
+};
+
+} // namespace toaster
+
+#define TOASTER_SITE_ID(expr) \
+    (std::integral_constant<std::uint64_t, toaster::site_id(TOASTER_SITE ":" #expr)>::value)
+
+/**
+ * the plan TOASTER_TEST and TOASTER_TRY are compiled against, defined before toaster.hpp
+ * is included, e.g. -DTOASTER_PLAN=stress_plan for a targeted build
+ */
+#ifndef TOASTER_PLAN
+#define TOASTER_PLAN toaster::every_site
+#endif
+
+#ifdef TOASTER
+#define TOASTER_TEST_INJECT(err, expr) \
+    if constexpr(TOASTER_PLAN::targets(TOASTER_SITE_ID(expr))) { \
+        static const char *const toaster_site_ \
+            __attribute__((used, section("toaster_sites"))) = TOASTER_SITE; \
+        if(0 != toaster_check_site(toaster_site_)) { \
+            if(!err) { \
+                err = -1; \
+            } \
+            TOASTER_LOG("inject:%s:%016llx", #expr, \
+                        static_cast<unsigned long long>(TOASTER_SITE_ID(expr))); \
+            goto CHECK(err); \
+        } \
+    }
+#else
+#define TOASTER_TEST_INJECT(err, expr)
+#endif
+
+/**
+ * TEST for C++, with the site checked only if it is in TOASTER_PLAN
+ */
+#define TOASTER_TEST(err, expr) \
+    do { \
+        TOASTER_LOG("call:%s", #expr); \
+        TOASTER_TEST_INJECT(err, expr) \
+        if(!(expr)) { \
+            if(!err) { \
+                err = -1; \
+            } \
+            TOASTER_LOG("fail:%s", #expr); \
+            goto CHECK(err); \
+        } else { \
+            TOASTER_LOG("pass:%s", #expr); \
+        } \
+    } while(0)
+
+#if defined(__cpp_lib_expected)
+#ifdef TOASTER
+#define TOASTER_TRY_INJECT(result, expr) \
+    if constexpr(TOASTER_PLAN::targets(TOASTER_SITE_ID(expr))) { \
+        static const char *const toaster_site_ \
+            __attribute__((used, section("toaster_sites"))) = TOASTER_SITE; \
+        if(0 != toaster_check_site(toaster_site_)) { \
+            TOASTER_LOG("inject:%s:%016llx", #expr, \
+                        static_cast<unsigned long long>(TOASTER_SITE_ID(expr))); \
+            return std::unexpected( \
+                toaster::injected_error<typename result::error_type>::value()); \
+        } \
+    }
+#else
+#define TOASTER_TRY_INJECT(result, expr)
+#endif
+
+/**
+ * evaluates to the value of the std::expected `expr`, or returns its error, or an
+ * injected one, from the enclosing function, which returns a std::expected as well
+ */
+#define TOASTER_TRY(expr) \
+    ({ \
+        using toaster_result_ = std::remove_cvref_t<decltype(expr)>; \
+        TOASTER_LOG("call:%s", #expr); \
+        TOASTER_TRY_INJECT(toaster_result_, expr) \
+        toaster_result_ toaster_r_ = (expr); \
+        if(!toaster_r_.has_value()) { \
+            TOASTER_LOG("fail:%s", #expr); \
+            return std::unexpected(std::move(toaster_r_).error()); \
+        } \
+        TOASTER_LOG("pass:%s", #expr); \
+        *std::move(toaster_r_); \
+    })
+#endif
+
+#endif //TOASTER_HPP
@@ -0,0 +1,264 @@
+/**
+ * bench.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "toaster.h"
+
+/**
+ * microbenchmarks for what the instrumentation costs
+ * results go to stdout and, as json, to the file named by the first argument
+ */
+
+#define RESULTS 40
+#define THREADS 8
+#define TESTS 8
+/** edges a small test's iteration hits, a few percent of the map's 64 byte blocks */
+#define BITMAP_EDGES 64
+
+struct result {
+    const char *name;
+    int threads;
+    long long ops;
+    double ns;
+};
+
+int bench_site_off(int x);
+int bench_site_on(int x);
+
+static struct result gresults[RESULTS];
+static int gresults_len;
+static volatile int gsink;
+static long long giterations;
+static unsigned char gmap[TOASTER_EDGE_MAP] __attribute__((aligned(64)));
+static unsigned char gseen[TOASTER_EDGE_MAP] __attribute__((aligned(64)));
+
+static const char *gbitmaps[][3] = {
+    [TOASTER_BITMAP_SCALAR] = {"classify_scalar", "merge_scalar", "new_bits_scalar"},
+    [TOASTER_BITMAP_SSE2] = {"classify_sse2", "merge_sse2", "new_bits_sse2"},
+    [TOASTER_BITMAP_AVX2] = {"classify_avx2", "merge_avx2", "new_bits_avx2"},
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void record(const char *name, int threads, long long ops, double ns) {
+    struct result *r = &gresults[gresults_len++];
+    r->name = name;
+    r->threads = threads;
+    r->ops = ops;
+    r->ns = ns;
+    printf("%-20s %2d threads %12lld ops %10.2f ns/op\n", name, threads, ops, ns / ops);
+}
+
+static void site(const char *name, int (*fn)(int), long long ops) {
+    double start = now_ns();
+    long long i;
+    int sink = 0;
+    for(i = 0; i < ops; ++i) {
+        sink += fn((int)i);
+    }
+    gsink = sink;
+    record(name, 1, ops, now_ns() - start);
+}
+
+static void *checks(void *arg) {
+    long long ops = *(const long long *)arg;
+    long long i;
+    int sink = 0;
+    for(i = 0; i < ops; ++i) {
+        sink += toaster_check();
+    }
+    gsink = sink;
+    return 0;
+}
+
+/** ns/op is per thread, the wall time of one thread's ops while the others run theirs */
+static void contended(const char *name, int threads, long long ops) {
+    pthread_t t[THREADS];
+    double start;
+    int i;
+    toaster_set(INT_MAX);
+    start = now_ns();
+    for(i = 0; i < threads; ++i) {
+        pthread_create(&t[i], 0, checks, &ops);
+    }
+    for(i = 0; i < threads; ++i) {
+        pthread_join(t[i], 0);
+    }
+    record(name, threads, ops, now_ns() - start);
+    toaster_end();
+}
+
+static void sockets(const char *name, int (*sock)(int, int, int), int (*cls)(int), long long ops) {
+    double start = now_ns();
+    long long i;
+    for(i = 0; i < ops; ++i) {
+        cls(sock(AF_UNIX, SOCK_DGRAM, 0));
+    }
+    record(name, 1, ops, now_ns() - start);
+}
+
+/** binding a bound socket again fails in the kernel with EINVAL, the cheapest real bind */
+static void binds(const char *name, int (*bnd)(int, const struct sockaddr *, socklen_t),
+                  int fd, const struct sockaddr_un *addr, long long ops) {
+    double start = now_ns();
+    long long i;
+    for(i = 0; i < ops; ++i) {
+        gsink = bnd(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    }
+    record(name, 1, ops, now_ns() - start);
+}
+
+static int sweep_test(void) {
+    int i;
+    ++giterations;
+    for(i = 0; i < TESTS; ++i) {
+        if(bench_site_on(i)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/** the runtime logs every iteration, stderr goes to /dev/null so the terminal is not timed */
+static void sweeps(const char *name, long long sweeps) {
+    int null = open("/dev/null", O_WRONLY);
+    int err = dup(2);
+    double start;
+    long long i;
+    fflush(stderr);
+    dup2(null, 2);
+    start = now_ns();
+    for(i = 0; i < sweeps; ++i) {
+        gsink = toaster_run_range(0, TESTS + 1, sweep_test);
+    }
+    record(name, 1, giterations, now_ns() - start);
+    fflush(stderr);
+    dup2(err, 2);
+    close(err);
+    close(null);
+}
+
+/**
+ * the edge map after an iteration that hit BITMAP_EDGES edges, new bits against the merged map,
+ * the common case of an iteration that found nothing, kernels the cpu lacks are left out
+ */
+static void bitmaps(int kernel, long long ops) {
+    double start;
+    long long i;
+    int sink = 0;
+    int edges;
+    if(toaster_bitmap_kernel(kernel) != kernel) {
+        return;
+    }
+    memset(gseen, 0, sizeof(gseen));
+    for(i = 0; i < BITMAP_EDGES; ++i) {
+        gmap[(i * 7919) % TOASTER_EDGE_MAP] = (unsigned char)(i + 1);
+    }
+    start = now_ns();
+    for(i = 0; i < ops; ++i) {
+        toaster_bitmap_classify(gmap, sizeof(gmap));
+    }
+    record(gbitmaps[kernel][0], 1, ops, now_ns() - start);
+    start = now_ns();
+    for(i = 0; i < ops; ++i) {
+        toaster_bitmap_merge(gseen, gmap, sizeof(gmap));
+    }
+    record(gbitmaps[kernel][1], 1, ops, now_ns() - start);
+    start = now_ns();
+    for(i = 0; i < ops; ++i) {
+        sink += toaster_bitmap_new(gmap, gseen, sizeof(gmap), &edges);
+    }
+    record(gbitmaps[kernel][2], 1, ops, now_ns() - start);
+    gsink = sink + gseen[0];
+}
+
+static int write_json(const char *path) {
+    FILE *f = fopen(path, "w");
+    int i;
+    if(!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "{\"results\": [\n");
+    for(i = 0; i < gresults_len; ++i) {
+        const struct result *r = &gresults[i];
+        fprintf(f, "  {\"name\": \"%s\", \"threads\": %d, \"ops\": %lld, "
+                   "\"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}%s\n",
+                r->name, r->threads, r->ops, r->ns / r->ops, r->ops * 1e9 / r->ns,
+                i + 1 < gresults_len ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    return fclose(f);
+}
+
+int main(int argc, char * const argv[]) {
+    int (*real_socket)(int, int, int) = dlsym(RTLD_NEXT, "socket");
+    int (*real_bind)(int, const struct sockaddr *, socklen_t) = dlsym(RTLD_NEXT, "bind");
+    int (*real_close)(int) = dlsym(RTLD_NEXT, "close");
+    struct sockaddr_un addr = {AF_UNIX, ""};
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus < 2 ? 2 : cpus > THREADS ? THREADS : (int)cpus;
+    int fd;
+
+    site("test_off", bench_site_off, 100000000);
+    toaster_end();
+    site("test_disarmed", bench_site_on, 100000000);
+    toaster_set(INT_MAX);
+    site("test_armed", bench_site_on, 100000000);
+    toaster_end();
+
+    contended("check_1_thread", 1, 10000000);
+    contended("check_contended", threads, 10000000);
+
+    sockets("socket_direct", real_socket, real_close, 100000);
+    sockets("socket_mock", socket, close, 100000);
+    /** abstract unix address, nothing on disk to clean up */
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "toaster_bench_%d", (int)getpid());
+    fd = real_socket(AF_UNIX, SOCK_DGRAM, 0);
+    real_bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
+    binds("bind_direct", real_bind, fd, &addr, 1000000);
+    binds("bind_mock", bind, fd, &addr, 1000000);
+    real_close(fd);
+
+    toaster_set_jobs(1);
+    sweeps("sweep_iterations", 20000);
+
+    bitmaps(TOASTER_BITMAP_SCALAR, 100000);
+    bitmaps(TOASTER_BITMAP_SSE2, 100000);
+    bitmaps(TOASTER_BITMAP_AVX2, 100000);
+
+    return argc > 1 ? write_json(argv[1]) : 0;
+}
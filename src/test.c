@@ -30,27 +30,11 @@
 #include <unistd.h>
 #include <assert.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "toaster.h"
-/** mock for bind */
-int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
-    int (*real)(int, const struct sockaddr *, socklen_t) = dlsym(RTLD_NEXT, "bind");
-    if(!toaster_check()) {
-        return real(sockfd, addr, addrlen);
-    }
-    TOASTER_LOG("mock failure: bind");
-    return -1;
-}
-
-/** mock for socket*/
-int socket(int domain, int type, int protocol) {
-    int (*real)(int domain, int type, int protocol) = dlsym(RTLD_NEXT, "socket");
-    if(!toaster_check()) {
-        return real(domain, type, protocol);
-    }
-    TOASTER_LOG("mock failure: socket");
-    return -1;
-}
 
 int unix_sock_create_and_bind(const char *path, int *fd) {
     int err = 0;
@@ -105,7 +89,152 @@ CHECK(err):
     return err;
 }
 
+/**
+ * sends three numbered messages until the receiver has all of them,
+ * dropped, truncated, duplicated or late messages are sent again or ignored
+ */
+int test_retry(void) {
+    int err = 0;
+    int a = -1, b = -1;
+    int i, tries;
+    unsigned got = 0;
+    ssize_t n;
+    char msg[8] = "msg0";
+    struct sockaddr_un addr = {AF_UNIX, "bar"};
+    TEST(err, !unix_sock_create_and_bind("foo", &a));
+    TEST(err, !unix_sock_create_and_bind("bar", &b));
+    for(tries = 0; got != 7 && tries < 3; ++tries) {
+        for(i = 0; i < 3; ++i) {
+            msg[3] = '0' + i;
+            if(!(got & (1 << i))) {
+                TEST(err, 5 == sendto(a, msg, 5, 0, (struct sockaddr *)&addr, sizeof(addr)));
+            }
+        }
+        while(0 < (n = recvfrom(b, msg, sizeof(msg), MSG_DONTWAIT, 0, 0))) {
+            if(n == 5 && msg[3] >= '0' && msg[3] <= '2') {
+                got |= 1 << (msg[3] - '0');
+            }
+        }
+    }
+    TEST(err, got == 7);
+CHECK(err):
+    if(-1 != a) {
+        close(a);
+    }
+    if(-1 != b) {
+        close(b);
+    }
+    return err;
+}
+
+/**
+ * an abstract name is every byte up to addrlen, a pathname may fill sun_path
+ * without a NUL, each is bound and answered on the fake network
+ */
+int test_names(void) {
+    int err = 0;
+    int a = -1, b = -1;
+    char msg[4];
+    struct sockaddr_un abstract = {AF_UNIX, "\0foo"}, full = {AF_UNIX}, from;
+    socklen_t alen = offsetof(struct sockaddr_un, sun_path) + 4, len;
+    memset(full.sun_path, 'x', sizeof(full.sun_path));
+    a = socket(AF_UNIX, SOCK_DGRAM, 0);
+    b = socket(AF_UNIX, SOCK_DGRAM, 0);
+    TEST(err, a >= 0 && b >= 0);
+    TEST(err, !bind(a, (struct sockaddr *)&abstract, alen));
+    TEST(err, !bind(b, (struct sockaddr *)&full, sizeof(full)));
+    TEST(err, -1 == sendto(b, "hi", 2, 0, (struct sockaddr *)&abstract, alen - 1) &&
+              errno == ECONNREFUSED);
+    TEST(err, 2 == sendto(a, "hi", 2, 0, (struct sockaddr *)&full, sizeof(full)));
+    len = sizeof(from);
+    TEST(err, 2 == recvfrom(b, msg, sizeof(msg), 0, (struct sockaddr *)&from, &len));
+    TEST(err, len == alen && !memcmp(from.sun_path, "\0foo", 4));
+    TEST(err, 2 == sendto(b, "hi", 2, 0, (struct sockaddr *)&from, len));
+    len = sizeof(from);
+    TEST(err, 2 == recvfrom(a, msg, sizeof(msg), 0, (struct sockaddr *)&from, &len));
+    TEST(err, len == sizeof(from) && !memcmp(from.sun_path, full.sun_path, sizeof(full.sun_path)));
+CHECK(err):
+    if(-1 != a) {
+        close(a);
+    }
+    if(-1 != b) {
+        close(b);
+    }
+    return err;
+}
+
+static int socket_errnos_seen[16];
+static int socket_errnos_len;
+
+/** every errno in the socket table should be swept */
+int test_socket_errno(void) {
+    int err = 0;
+    int i;
+    int s = socket(AF_UNIX, SOCK_DGRAM, 0);
+    for(i = 0; s < 0 && i < socket_errnos_len && errno != socket_errnos_seen[i]; ++i) {
+    }
+    if(s < 0 && i == socket_errnos_len) {
+        socket_errnos_seen[socket_errnos_len++] = errno;
+    }
+    TEST(err, s >= 0);
+CHECK(err):
+    if(s != -1) {
+        close(s);
+    }
+    return err;
+}
+
+/** backs off for twice as long as a slow socket call took, amplifying its latency */
+int test_backoff(void) {
+    int err = 0;
+    struct timespec start, end;
+    long us;
+    int s;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    s = socket(AF_UNIX, SOCK_DGRAM, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    TEST(err, s >= 0);
+    if(us > 1000) {
+        usleep(2 * us);
+    }
+CHECK(err):
+    if(s != -1) {
+        close(s);
+    }
+    return err;
+}
+
 int main(int _argc, char * const _argv[]) {
     assert(0 == toaster_run_max(100, test_talk));
+    assert(0 == toaster_run_errno_range(0, 100, test_socket_errno));
+    assert(socket_errnos_len == 8);
+    toaster_set_jobs(4);
+    assert(0 == toaster_run_errno_range(0, 100, test_socket_errno));
+
+    /** parallel workers can share paths on the fake network */
+    toaster_net_fake(1);
+    assert(0 == toaster_run_max(100, test_talk));
+    assert(0 == toaster_run_errno_range(0, 100, test_talk));
+    assert(0 == toaster_run_max(100, test_names));
+    toaster_net_faults(TOASTER_NET_FAULTS);
+    assert(0 == toaster_run_max(1000, test_retry));
+    toaster_net_faults(0);
+    toaster_net_fake(0);
+    toaster_set_jobs(1);
+
+    struct toaster_latency fixed = {TOASTER_DIST_FIXED, 5000, 5000, 0};
+    struct toaster_latency pareto = {TOASTER_DIST_PARETO, 5000, 5000, 1.5};
+    assert(0 == toaster_set_latency(0, &fixed));
+    assert(0 == toaster_set_latency("socket", &pareto));
+    struct toaster_latency flat = {TOASTER_DIST_PARETO, 5000, 5000, 0};
+    assert(-1 == toaster_set_latency("socket", &flat) && errno == EINVAL);
+    flat.alpha = -1.5;
+    assert(-1 == toaster_set_latency(0, &flat) && errno == EINVAL);
+    assert(1 == toaster_run_latency_range(0, 10, test_backoff));
+
+    toaster_set_probability(1.0, 0);
+    assert(0 != toaster_run(test_backoff));
+    toaster_set_probability(0, 0);
     return 0;
 }
@@ -0,0 +1,89 @@
+/**
+ * test_bitmap.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "toaster.h"
+
+/** odd on purpose, the vector kernels leave a tail to the scalar one */
+#define LEN (TOASTER_EDGE_MAP + 77)
+#define KERNELS (TOASTER_BITMAP_AVX2 + 1)
+
+static unsigned char gmap[KERNELS][LEN];
+static unsigned char gseen[KERNELS][LEN];
+static int gnew[KERNELS];
+static int gedges[KERNELS];
+
+static int bucket(int v) {
+    static const int bottoms[] = {0, 1, 2, 3, 4, 8, 16, 32, 128};
+    static const int buckets[] = {0, 1, 2, 4, 8, 16, 32, 64, 128};
+    int j = 0;
+    while(j < 8 && v >= bottoms[j + 1]) {
+        ++j;
+    }
+    return buckets[j];
+}
+
+/**
+ * sparse counts at offsets that straddle the blocks the kernels skip, and a tail of
+ * every count, halved for the seen map so the top of the map is new buckets on old edges
+ */
+static void fill(unsigned char *map, unsigned seed, int shift) {
+    int i;
+    memset(map, 0, LEN);
+    srand(seed);
+    for(i = 0; i < 512; ++i) {
+        map[rand() % LEN] = rand() % 256;
+    }
+    for(i = 0; i < 256; ++i) {
+        map[LEN - 256 + i] = i >> shift;
+    }
+}
+
+int main(int _argc, char * const _argv[]) {
+    int k, i;
+    assert(TOASTER_BITMAP_SCALAR == toaster_bitmap_kernel(-1));
+    assert(toaster_bitmap_kernel(KERNELS) <= TOASTER_BITMAP_AVX2);
+    for(k = 0; k < KERNELS; ++k) {
+        assert(toaster_bitmap_kernel(k) <= k);
+        fill(gseen[k], 1, 1);
+        toaster_bitmap_classify(gseen[k], LEN);
+        fill(gmap[k], 2, 0);
+        toaster_bitmap_classify(gmap[k], LEN);
+        gnew[k] = toaster_bitmap_new(gmap[k], gseen[k], LEN, &gedges[k]);
+        toaster_bitmap_merge(gseen[k], gmap[k], LEN);
+        /** merged, nothing in the map is new */
+        assert(0 == toaster_bitmap_new(gmap[k], gseen[k], LEN, &i) && 0 == i);
+    }
+    for(i = 0; i < 256; ++i) {
+        assert(gmap[0][LEN - 256 + i] == bucket(i));
+    }
+    assert(gnew[0] > gedges[0] && gedges[0] > 0);
+    for(k = 1; k < KERNELS; ++k) {
+        assert(0 == memcmp(gmap[0], gmap[k], LEN));
+        assert(0 == memcmp(gseen[0], gseen[k], LEN));
+        assert(gnew[0] == gnew[k] && gedges[0] == gedges[k]);
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * test_budget.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#include "toaster.h"
+
+#define PLAIN 64
+#define STEPS 8
+#define FAILS 8
+/** the counting run, the spread sample of an eighth and the 8 other failing sites */
+#define SAMPLE (1 + (PLAIN + STEPS + FAILS) / 8 + 1)
+
+static long gsleep_ms;
+static int gbroken;
+static int gfailing;
+static int gcalls;
+static int gunwound[STEPS];
+static int gfailed[FAILS];
+
+/** every step has its own cleanup, so each of their failures takes new edges */
+static void unwind(int step) {
+    switch(step) {
+    case 0: gunwound[0] = gcalls; break;
+    case 1: gunwound[1] = gcalls; break;
+    case 2: gunwound[2] = gcalls; break;
+    case 3: gunwound[3] = gcalls; break;
+    case 4: gunwound[4] = gcalls; break;
+    case 5: gunwound[5] = gcalls; break;
+    case 6: gunwound[6] = gcalls; break;
+    default: gunwound[7] = gcalls; break;
+    }
+}
+
+/**
+ * plain checks fail down the same path, the steps after them each unwind their own way,
+ * and with `gfailing` the last checks leave a broken invariant behind down a single path
+ */
+int test_steps(void) {
+    struct timespec ts = {0, gsleep_ms * 1000000};
+    int i;
+    ++gcalls;
+    nanosleep(&ts, 0);
+    if(gbroken) {
+        return -1;
+    }
+    for(i = 0; i < PLAIN; ++i) {
+        if(toaster_check_site("plain.c:1")) {
+            return -1;
+        }
+    }
+    for(i = 0; i < STEPS; ++i) {
+        if(toaster_check_site("steps.c:1")) {
+            unwind(i);
+            return -1;
+        }
+    }
+    for(i = 0; gfailing && i < FAILS; ++i) {
+        if(toaster_check_site("fails.c:1")) {
+            gfailed[i] = gcalls;
+            toaster_fail("invariant");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int _argc, char * const _argv[]) {
+    struct toaster_budget report;
+    int i, j;
+    assert(0 == toaster_budget_run_range(0, INT_MAX, 60000, test_steps));
+    toaster_budget_report(&report);
+    assert(report.complete && report.counters == PLAIN + STEPS);
+    assert(report.iterations == report.counters && report.edges > 0 && !report.failures);
+    /** the steps that add edges run before the plain checks that do not */
+    for(i = 0; i < STEPS; ++i) {
+        assert(gunwound[i] <= SAMPLE + STEPS);
+    }
+
+    /**
+     * the failing sites go first and the steps after them, but for the first step, which
+     * is in the sample, and the last, next to the first failing site, whatever the time
+     */
+    gfailing = 1;
+    gcalls = 0;
+    assert(-1 == toaster_budget_run_range(0, INT_MAX, 60000, test_steps));
+    toaster_budget_report(&report);
+    assert(report.complete && report.failures == FAILS);
+    for(i = 0; i < FAILS; ++i) {
+        assert(gfailed[i] <= SAMPLE + FAILS);
+        for(j = 1; j < STEPS - 1; ++j) {
+            assert(gfailed[i] < gunwound[j]);
+        }
+    }
+    for(j = 0; j < STEPS; ++j) {
+        assert(gunwound[j] <= SAMPLE + FAILS + STEPS);
+    }
+    gfailing = 0;
+
+    /** 20ms an iteration is too slow for the whole sweep in 100ms */
+    gsleep_ms = 20;
+    assert(0 == toaster_budget_run_range(0, INT_MAX, 100, test_steps));
+    toaster_budget_report(&report);
+    assert(!report.complete && report.iterations < report.counters);
+
+    /** a test that fails by itself fails the clean run */
+    gsleep_ms = 0;
+    gbroken = 1;
+    assert(-1 == toaster_budget_run_range(0, 10, 1000, test_steps));
+    toaster_budget_report(&report);
+    assert(report.failures == 1 && report.counters == 0);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ * test_caller.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+#include "toaster.h"
+
+static int gruns;
+
+/** stands in for logging and library code that maps memory and copes when it cannot */
+__attribute__((noinline)) void noise(void) {
+    void *p = mmap(0, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p != MAP_FAILED) {
+        munmap(p, 4096);
+    }
+}
+
+/** the code under test */
+__attribute__((noinline)) int owned(void) {
+    int err = 0;
+    void *p = mmap(0, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST(err, p != MAP_FAILED);
+    TEST(err, !munmap(p, 4096));
+CHECK(err):
+    return err;
+}
+
+int test_app(void) {
+    int err = 0;
+    int i;
+    ++gruns;
+    for(i = 0; i < 4; ++i) {
+        noise();
+    }
+    TEST(err, !owned());
+CHECK(err):
+    return err;
+}
+
+/** the number of iterations a sweep of test_app takes */
+static int sweep(void) {
+    gruns = 0;
+    assert(0 == toaster_run_range(0, 1000, test_app));
+    return gruns;
+}
+
+int main(int _argc, char * const _argv[]) {
+    int all, mine, none;
+    toaster_mmap_faults(1);
+    all = sweep();
+    assert(0 == toaster_filter_function((void *)owned));
+    mine = sweep();
+    assert(mine < all);
+    toaster_filter_clear();
+    assert(0 == toaster_filter_module(dlsym(RTLD_DEFAULT, "printf")));
+    none = sweep();
+    assert(none < mine);
+    toaster_filter_clear();
+    assert(0 == toaster_filter_module((void *)main));
+    assert(all == sweep());
+    toaster_filter_clear();
+    assert(-1 == toaster_filter_function((void *)1));
+    assert(-1 == toaster_filter_module((void *)1));
+    toaster_mmap_faults(0);
+    return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * test_context.cpp
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define TOASTER_SHOW_LOG
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "toaster.hpp"
+
+/** a real multi-threaded executor, steps of one operation land on any of its threads */
+class pool {
+public:
+    explicit pool(int n) {
+        for(int i = 0; i < n; ++i) {
+            threads_.emplace_back([this] { work(); });
+        }
+    }
+    ~pool() {
+        post(nullptr);
+        for(auto &t : threads_) {
+            t.join();
+        }
+    }
+    void post(std::function<void()> f) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(f));
+        ready_.notify_one();
+    }
+
+private:
+    /** an empty task stops the workers, it is left in the queue for the next one */
+    void work() {
+        for(;;) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] { return !tasks_.empty(); });
+            std::function<void()> f = tasks_.front();
+            if(!f) {
+                ready_.notify_one();
+                return;
+            }
+            tasks_.pop_front();
+            lock.unlock();
+            f();
+        }
+    }
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+};
+
+struct job {
+    struct promise_type : toaster::context_promise {
+        job get_return_object() noexcept {
+            return {};
+        }
+        auto initial_suspend() noexcept {
+            return in_context(std::suspend_never{});
+        }
+        auto final_suspend() noexcept {
+            return leave(std::suspend_never{});
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+/** resumes the coroutine on the pool */
+struct hop {
+    pool &p;
+    bool await_ready() noexcept {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        p.post([h] { h.resume(); });
+    }
+    void await_resume() noexcept {}
+};
+
+/** a callback on the pool, bound to the operation that posted it, that resumes it after */
+struct audit {
+    pool &p;
+    int &err;
+    auto operator co_await() {
+        struct awaiter {
+            pool &p;
+            int &err;
+            bool await_ready() noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> h) {
+                p.post(toaster::bind([h, this] {
+                    err = err ? err : toaster_check_site("audit");
+                    h.resume();
+                }));
+            }
+            void await_resume() noexcept {}
+        };
+        return awaiter{p, err};
+    }
+};
+
+static std::atomic<int> gfailed;
+static std::atomic<bool> gnoisy{true};
+
+/** a request that hops threads between its steps */
+static job request(pool &p, std::promise<int> &done) {
+    int err = 0;
+    co_await hop{p};
+    err = toaster_check_site("parse");
+    co_await hop{p};
+    err = err ? err : toaster_check_site("store");
+    co_await audit{p, err};
+    std::suspend_never ready;
+    co_await ready;
+    err = err ? err : toaster_check_site("reply");
+    gfailed += err != 0;
+    done.set_value(err);
+}
+
+/** unrelated work on the same threads, its checks must never consume the counter */
+static void noise(pool &p) {
+    toaster_check_site("noise");
+    if(gnoisy) {
+        p.post([&p] { noise(p); });
+    }
+}
+
+static int operation(pool &p) {
+    toaster::context_guard guard(toaster::context::iteration());
+    std::promise<int> done;
+    std::future<int> rv = done.get_future();
+    request(p, done);
+    assert(toaster::context().id() == toaster::context::iteration().id());
+    return rv.get();
+}
+
+int main(int _argc, char * const _argv[]) {
+    pool p(4);
+    p.post([&p] { noise(p); });
+    toaster_set_contexts(1);
+    assert(0 == toaster::run(0, 100, [&p] { return operation(p); }));
+    assert(gfailed == 4);
+    assert(toaster::context().id() == 0);
+    toaster_set_contexts(0);
+    gnoisy = false;
+    return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * test_cpp.cpp
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define TOASTER_SHOW_LOG
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "toaster.hpp"
+
+#define PATH "/tmp/toaster_cpp"
+
+static int gopen;
+
+static std::expected<int, std::error_code> open_fd(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0) {
+        return std::unexpected(std::error_code(errno, std::system_category()));
+    }
+    ++gopen;
+    return fd;
+}
+
+static std::expected<size_t, std::error_code> read_some(int fd, char *buf, size_t len) {
+    ssize_t n = ::read(fd, buf, len);
+    if(n < 0) {
+        return std::unexpected(std::error_code(errno, std::system_category()));
+    }
+    return static_cast<size_t>(n);
+}
+
+static std::expected<void, std::error_code> not_empty(size_t len) {
+    if(!len) {
+        return std::unexpected(std::make_error_code(std::errc::no_message));
+    }
+    return {};
+}
+
+/** a file read with RAII cleanup, every TOASTER_TRY is a site */
+static std::expected<std::string, std::error_code> slurp(const char *path) {
+    char buf[64];
+    int fd = TOASTER_TRY(open_fd(path));
+    toaster::scope closer([fd] {
+        ::close(fd);
+        --gopen;
+    });
+    size_t n = TOASTER_TRY(read_some(fd, buf, sizeof(buf)));
+    TOASTER_TRY(not_empty(n));
+    return std::string(buf, n);
+}
+
+static std::expected<int, int> parse(const std::string &s) {
+    if(s.empty() || s[0] < '0' || s[0] > '9') {
+        return std::unexpected(EINVAL);
+    }
+    return s[0] - '0';
+}
+
+/** an int error type gets -1 when injected */
+static std::expected<int, int> first_digit(const std::string &s) {
+    int d = TOASTER_TRY(parse(s));
+    return d;
+}
+
+int main(int _argc, char * const _argv[]) {
+    int runs = 0, err = 0;
+    int fd = ::open(PATH, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    assert(fd >= 0 && 2 == ::write(fd, "7\n", 2));
+    ::close(fd);
+    /** three sites, then the pass */
+    assert(0 == toaster::run(0, 100, [&] {
+        ++runs;
+        return slurp(PATH);
+    }));
+    assert(runs == 4);
+    assert(gopen == 0);
+    assert(!slurp("/dev/null").has_value());
+    assert(!slurp("/nonexistent").has_value());
+    assert(slurp("/tmp").error() == std::errc::is_a_directory);
+    assert(0 == toaster::run(0, 100, [] { return first_digit("7"); }));
+    assert(first_digit("x").error() == EINVAL);
+    toaster_set(0);
+    assert(first_digit("7").error() == -1);
+    toaster_end();
+    /** a lambda with the C macros and an int status, and a scope that is dismissed */
+    const auto with_c = [&]() -> int {
+        int err = 0;
+        int fd = ::open(PATH, O_RDONLY);
+        toaster::scope closer([fd] { ::close(fd); });
+        TEST(err, fd >= 0);
+        closer.dismiss();
+        ::close(fd);
+    CHECK(err):
+        return err;
+    };
+    assert(0 == toaster::run_errno(0, 100, with_c));
+    assert(toaster::injected_error<std::errc>::value() == std::errc::io_error);
+    assert(toaster::injected_error<std::error_code>::value() == std::errc::io_error);
+    assert(toaster::injected_error<std::string>::value().empty());
+    ::unlink(PATH);
+    assert(0 != with_c());
+    return err;
+}
@@ -0,0 +1,96 @@
+/**
+ * test_disk.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "toaster.h"
+
+/** write `len` bytes, resuming after short writes */
+int write_all(int fd, const char *buf, size_t len) {
+    int err = 0;
+    ssize_t n;
+    while(len) {
+        n = write(fd, buf, len);
+        TEST(err, n > 0);
+        buf += n;
+        len -= n;
+    }
+CHECK(err):
+    assert(!err || errno == ENOSPC || errno == EDQUOT);
+    return err;
+}
+
+/** replace disk.dat with a temp file that is written, synced and renamed, or leave no trace */
+int test_save(void) {
+    int err = 0;
+    struct stat st;
+    int fd = open("disk.tmp", O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    TEST(err, fd >= 0);
+    TEST(err, !fallocate(fd, 0, 0, 16));
+    TEST(err, !write_all(fd, "header: 16 bytes", 16));
+    TEST(err, !write_all(fd, "body of 16 bytes", 16));
+    TEST(err, 8 == pwrite(fd, "trailer!", 8, 32));
+    TEST(err, !fsync(fd));
+    TEST(err, !close(fd));
+    fd = -1;
+    TEST(err, !rename("disk.tmp", "disk.dat"));
+    TEST(err, !stat("disk.dat", &st) && st.st_size == 40);
+CHECK(err):
+    if(fd != -1) {
+        close(fd);
+        unlink("disk.tmp");
+    }
+    assert(access("disk.tmp", F_OK));
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    assert(0 == toaster_disk_run_range(0, 128, 4, test_save));
+    toaster_disk_errno(EDQUOT);
+    assert(0 == toaster_disk_run_range(0, 128, 1, test_save));
+    toaster_disk_budget(55);
+    assert(0 != toaster_run(test_save));
+    toaster_disk_budget(-1);
+    assert(0 == toaster_run(test_save));
+    assert(!unlink("disk.dat"));
+    assert(-1 == toaster_disk_run_range(0, LLONG_MAX, 1, test_save) && errno == EINVAL);
+    assert(-1 == toaster_disk_run_range(64, 0, 1, test_save) && errno == EINVAL);
+    assert(-1 == toaster_disk_run_range(-1, 0, 1, test_save) && errno == EINVAL);
+    /** a short write succeeds without touching errno */
+    int fd = open("disk.tmp", O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    toaster_disk_budget(4);
+    errno = 0;
+    assert(4 == write(fd, "header: 16 bytes", 16) && !errno);
+    assert(-1 == write(fd, "header: 16 bytes", 16) && errno == EDQUOT);
+    toaster_disk_budget(-1);
+    assert(!close(fd) && !unlink("disk.tmp"));
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * test_edges.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <stdlib.h>
+
+#include "toaster.h"
+
+#define ITEMS 8
+
+/**
+ * allocates ITEMS fields and frees them all on any failure, the site in the loop
+ * fails after 4 to 7 passes down the same edges, only the hit counts differ
+ */
+int test_parse(void) {
+    int err = 0;
+    char *items[ITEMS] = {0};
+    int i;
+    for(i = 0; i < ITEMS; ++i) {
+        TEST(err, items[i] = malloc(16));
+    }
+CHECK(err):
+    for(i = 0; i < ITEMS; ++i) {
+        free(items[i]);
+    }
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    int total;
+    assert(0 == toaster_run_range(0, ITEMS, test_parse));
+    total = toaster_edges_total();
+    assert(total > 0 && toaster_edges_new() > 0);
+    /** fails after 5, 6 and 7 passes land in the 4-7 bucket with the one after 4 */
+    assert(toaster_edges_stale() == 3);
+    /** the same sweep again adds nothing */
+    assert(0 == toaster_run_range(0, ITEMS, test_parse));
+    assert(toaster_edges_total() == total);
+    assert(toaster_edges_stale() == 3 + ITEMS + 1);
+    toaster_edges_clear();
+    assert(toaster_edges_total() == 0 && toaster_edges_stale() == 0);
+    assert(-1 == toaster_run_range(0, 0, test_parse) && toaster_edges_new() > 0);
+
+    /** parallel workers merge into the parent's map, and find what one process did */
+    toaster_edges_clear();
+    toaster_set_jobs(3);
+    assert(0 == toaster_run_range(0, ITEMS, test_parse));
+    toaster_set_jobs(1);
+    assert(toaster_edges_total() == total);
+    return 0;
+}
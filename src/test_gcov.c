@@ -0,0 +1,61 @@
+/**
+ * test_gcov.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <stdlib.h>
+
+#include "toaster.h"
+
+#define JOBS 4
+#define CRASH 3
+
+static int gsteps;
+
+static int step(void) {
+    return ++gsteps > 0;
+}
+
+/**
+ * every iteration runs in a forked worker, the one at counter CRASH aborts after
+ * its last check, so its lines are only covered if it dumps from the signal handler
+ */
+int test_sweep(void) {
+    int err = 0;
+    TEST(err, step());
+    TEST(err, step());
+    if(toaster_get() == CRASH - 2) {
+        gsteps = -gsteps;
+        abort();
+    }
+CHECK(err):
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    toaster_set_jobs(JOBS);
+    /** the crashed worker fails the sweep, the other workers still pass */
+    assert(-1 == toaster_run_range(0, 2 * JOBS, test_sweep));
+    /** none of the iterations ran here */
+    assert(gsteps == 0);
+    return 0;
+}
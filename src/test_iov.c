@@ -0,0 +1,231 @@
+/**
+ * test_iov.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "toaster.h"
+
+#define MSG "header, body and trailer"
+
+/** drop the first `n` bytes from the vector, possibly from the middle of an iovec */
+static void advance(struct iovec **iov, int *cnt, size_t n) {
+    while(*cnt && n >= (*iov)->iov_len) {
+        n -= (*iov)->iov_len;
+        ++*iov;
+        --*cnt;
+    }
+    if(*cnt) {
+        (*iov)->iov_base = (char *)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+}
+
+static void split(char *buf, struct iovec iov[3]) {
+    iov[0].iov_base = buf;
+    iov[0].iov_len = 8;
+    iov[1].iov_base = buf + 8;
+    iov[1].iov_len = 6;
+    iov[2].iov_base = buf + 14;
+    iov[2].iov_len = sizeof(MSG) - 14;
+}
+
+/** move MSG through a pipe with writev and readv, resuming after short transfers */
+int test_pipe(void) {
+    int err = 0;
+    int p[2] = {-1, -1};
+    char out[] = MSG;
+    char in[sizeof(MSG)] = {0};
+    struct iovec wv[3], rv[3], *w = wv, *r = rv;
+    int wn = 3, rn = 3;
+    ssize_t n;
+    split(out, wv);
+    split(in, rv);
+    TEST(err, !pipe(p));
+    while(wn) {
+        n = writev(p[1], w, wn);
+        TEST(err, n > 0);
+        advance(&w, &wn, n);
+    }
+    while(rn) {
+        n = readv(p[0], r, rn);
+        TEST(err, n > 0);
+        advance(&r, &rn, n);
+    }
+    TEST(err, !memcmp(in, out, sizeof(MSG)));
+CHECK(err):
+    if(p[0] != -1) {
+        close(p[0]);
+        close(p[1]);
+    }
+    return err;
+}
+
+/** the same over a stream socket with sendmsg and recvmsg */
+int test_stream(void) {
+    int err = 0;
+    int s[2] = {-1, -1};
+    char out[] = MSG;
+    char in[sizeof(MSG)] = {0};
+    struct iovec wv[3], rv[3];
+    struct msghdr wm = {0}, rm = {0};
+    ssize_t n;
+    split(out, wv);
+    split(in, rv);
+    wm.msg_iov = wv;
+    wm.msg_iovlen = 3;
+    rm.msg_iov = rv;
+    rm.msg_iovlen = 3;
+    TEST(err, !socketpair(AF_UNIX, SOCK_STREAM, 0, s));
+    while(wm.msg_iovlen) {
+        n = sendmsg(s[0], &wm, 0);
+        TEST(err, n > 0);
+        advance(&wm.msg_iov, (int *)&wm.msg_iovlen, n);
+    }
+    while(rm.msg_iovlen) {
+        n = recvmsg(s[1], &rm, 0);
+        TEST(err, n > 0);
+        advance(&rm.msg_iov, (int *)&rm.msg_iovlen, n);
+    }
+    TEST(err, !memcmp(in, out, sizeof(MSG)));
+CHECK(err):
+    if(s[0] != -1) {
+        close(s[0]);
+        close(s[1]);
+    }
+    return err;
+}
+
+/** pass an fd with a datagram, a truncated datagram or control message is an error */
+int test_datagram(void) {
+    int err = 0;
+    int s[2] = {-1, -1};
+    int fd = -1;
+    char out[] = MSG;
+    char in[sizeof(MSG)] = {0};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } wc, rc;
+    struct iovec wv[3], rv[3];
+    struct msghdr wm = {0}, rm = {0};
+    struct cmsghdr *c;
+    split(out, wv);
+    split(in, rv);
+    memset(&wc, 0, sizeof(wc));
+    memset(&rc, 0, sizeof(rc));
+    wm.msg_iov = wv;
+    wm.msg_iovlen = 3;
+    wm.msg_control = wc.buf;
+    wm.msg_controllen = sizeof(wc.buf);
+    c = CMSG_FIRSTHDR(&wm);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    rm.msg_iov = rv;
+    rm.msg_iovlen = 3;
+    rm.msg_control = rc.buf;
+    rm.msg_controllen = sizeof(rc.buf);
+    TEST(err, !socketpair(AF_UNIX, SOCK_DGRAM, 0, s));
+    memcpy(CMSG_DATA(c), &s[0], sizeof(int));
+    TEST(err, sizeof(MSG) == sendmsg(s[0], &wm, 0));
+    TEST(err, sizeof(MSG) == recvmsg(s[1], &rm, 0));
+    TEST(err, !(rm.msg_flags & (MSG_TRUNC | MSG_CTRUNC)));
+    c = CMSG_FIRSTHDR(&rm);
+    TEST(err, c && c->cmsg_type == SCM_RIGHTS);
+    memcpy(&fd, CMSG_DATA(c), sizeof(int));
+    TEST(err, !memcmp(in, out, sizeof(MSG)));
+CHECK(err):
+    if(fd != -1) {
+        close(fd);
+    }
+    if(s[0] != -1) {
+        close(s[0]);
+        close(s[1]);
+    }
+    return err;
+}
+
+/** writev and readv on a datagram socket move the whole message */
+int test_vector(void) {
+    int err = 0;
+    int s[2] = {-1, -1};
+    char out[] = MSG;
+    char in[sizeof(MSG)] = {0};
+    struct iovec wv[3], rv[3];
+    split(out, wv);
+    split(in, rv);
+    TEST(err, !socketpair(AF_UNIX, SOCK_DGRAM, 0, s));
+    TEST(err, sizeof(MSG) == writev(s[0], wv, 3));
+    TEST(err, sizeof(MSG) == readv(s[1], rv, 3));
+    TEST(err, !memcmp(in, out, sizeof(MSG)));
+CHECK(err):
+    if(s[0] != -1) {
+        close(s[0]);
+        close(s[1]);
+    }
+    return err;
+}
+
+/** a count past IOV_MAX is the kernel's EINVAL, never a copy on the stack */
+int test_count(void) {
+    int err = 0;
+    int p[2] = {-1, -1};
+    char buf[sizeof(MSG)] = {0};
+    struct iovec iov[3];
+    struct msghdr m = {0};
+    volatile int huge = INT_MAX, negative = -1;
+    split(buf, iov);
+    m.msg_iov = iov;
+    m.msg_iovlen = (size_t)IOV_MAX + 1;
+    TEST(err, !pipe(p));
+    TEST(err, -1 == writev(p[1], iov, huge) && errno == EINVAL);
+    TEST(err, -1 == readv(p[0], iov, huge) && errno == EINVAL);
+    TEST(err, -1 == writev(p[1], iov, negative) && errno == EINVAL);
+    TEST(err, -1 == sendmsg(p[1], &m, 0));
+    TEST(err, -1 == recvmsg(p[0], &m, 0));
+CHECK(err):
+    if(p[0] != -1) {
+        close(p[0]);
+        close(p[1]);
+    }
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    toaster_iov_faults(1);
+    assert(0 == toaster_run_range(0, 1000, test_pipe));
+    assert(0 == toaster_run_range(0, 1000, test_stream));
+    assert(0 == toaster_run_range(0, 1000, test_datagram));
+    assert(0 == toaster_run_range(0, 1000, test_vector));
+    assert(0 == toaster_run_range(0, 1000, test_count));
+    toaster_iov_faults(0);
+    return 0;
+}
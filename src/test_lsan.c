@@ -0,0 +1,83 @@
+/**
+ * test_lsan.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "toaster.h"
+
+/** leaked names, masked so lsan finds no pointer to them until the end frees them */
+#define MASK ((uintptr_t)0x5a5a5a5a5a5a5a5aULL)
+#define NAMES 4
+
+static uintptr_t gnames[NAMES];
+static int gnames_len;
+static const char *gbody_site;
+
+/** a record of a name and a body, a failing body forgets to free the name */
+int test_record(void) {
+    int err = 0;
+    char *name = 0, *body = 0;
+    TEST(err, name = malloc(24));
+    TEST(err, body = malloc(40));
+    free(body);
+    free(name);
+    return 0;
+CHECK(err):
+    if(name) {
+        /** only the body failing leaks the name */
+        gbody_site = toaster_injected_site();
+    }
+    gnames[gnames_len++] = (uintptr_t)name ^ MASK;
+    return err;
+}
+
+static void forget(void) {
+    int i;
+    for(i = 0; i < gnames_len; ++i) {
+        free((void *)(gnames[i] ^ MASK));
+    }
+    gnames_len = 0;
+}
+
+int main(int _argc, char * const _argv[]) {
+    assert(0 == toaster_run_range(0, 4, test_record));
+    assert(1 == toaster_lsan_leaks() && 24 == toaster_lsan_bytes() && 1 == toaster_failures());
+    assert(!strcmp(gbody_site, toaster_lsan_site()));
+    forget();
+
+    /** with the first leak freed, the same leak is new again */
+    assert(0 == toaster_run_range(0, 4, test_record));
+    assert(2 == toaster_lsan_leaks() && 48 == toaster_lsan_bytes());
+    forget();
+
+    /** the worker that runs the leaking counter counts it in the parent and exits cleanly */
+    toaster_set_jobs(2);
+    assert(0 == toaster_run_range(0, 4, test_record));
+    toaster_set_jobs(1);
+    assert(3 == toaster_lsan_leaks() && 72 == toaster_lsan_bytes());
+    assert(!strcmp(gbody_site, toaster_lsan_site()));
+    return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * test_malloc.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "toaster.h"
+
+struct buf {
+    char *data;
+    size_t len;
+};
+
+/** grow a buffer and keep an aligned copy, freeing everything on the way out */
+int test_buffers(void) {
+    int err = 0;
+    struct buf b = {0, 0};
+    char *grown;
+    int *zeros = 0;
+    void *aligned = 0, *page = 0, *legacy = 0;
+    b.data = malloc(16);
+    TEST(err, b.data != 0);
+    memset(b.data, 'x', 16);
+    grown = realloc(b.data, 4096);
+    TEST(err, grown != 0);
+    b.data = grown;
+    b.len = 4096;
+    zeros = calloc(16, sizeof(*zeros));
+    TEST(err, zeros != 0 && !zeros[15]);
+    TEST(err, !posix_memalign(&aligned, 64, 256));
+    page = aligned_alloc(4096, 4096);
+    TEST(err, page != 0);
+    legacy = memalign(32, 32);
+    TEST(err, legacy != 0);
+    free(valloc(1));
+    TEST(err, b.data[0] == 'x');
+CHECK(err):
+    free(legacy);
+    free(page);
+    free(aligned);
+    free(zeros);
+    free(b.data);
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    long long live = toaster_heap_live();
+    void *p = 0;
+    toaster_malloc_faults(1);
+    assert(0 == toaster_run_range(0, 100, test_buffers));
+    toaster_malloc_faults(0);
+    assert(toaster_heap_live() == live);
+    assert(EINVAL == posix_memalign(&p, 3, 8));
+    assert(!realloc(malloc(8), 0));
+    assert(toaster_heap_live() == live);
+    return 0;
+}
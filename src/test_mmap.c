@@ -0,0 +1,98 @@
+/**
+ * test_mmap.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "toaster.h"
+
+#define HUGE (2 << 20)
+#define PAGE 4096
+
+/** zero copy read of a file, compared against what was written */
+int test_reader(void) {
+    int err = 0;
+    int fd = -1;
+    char page[PAGE];
+    char *map = MAP_FAILED;
+    memset(page, 'x', sizeof(page));
+    fd = open("/tmp/toaster_mmap", O_CREAT | O_TRUNC | O_RDWR, 0600);
+    TEST(err, fd >= 0);
+    TEST(err, sizeof(page) == write(fd, page, sizeof(page)));
+    map = mmap(0, sizeof(page), PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    TEST(err, map != MAP_FAILED);
+    TEST(err, !madvise(map, sizeof(page), MADV_SEQUENTIAL));
+    TEST(err, !memcmp(map, page, sizeof(page)));
+CHECK(err):
+    if(map != MAP_FAILED) {
+        munmap(map, sizeof(page));
+    }
+    if(fd != -1) {
+        close(fd);
+        unlink("/tmp/toaster_mmap");
+    }
+    return err;
+}
+
+/**
+ * an arena that prefers huge pages, falls back to small ones,
+ * and grows in place when the mapping may not move
+ */
+int test_arena(void) {
+    int err = 0;
+    size_t len = HUGE;
+    char *arena = mmap(0, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    char *grown;
+    if(arena == MAP_FAILED) {
+        arena = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    TEST(err, arena != MAP_FAILED);
+    arena[0] = 1;
+    grown = mremap(arena, len, 2 * len, MREMAP_MAYMOVE);
+    TEST(err, grown != MAP_FAILED);
+    arena = grown;
+    len *= 2;
+    TEST(err, arena[0] == 1);
+    arena[len - 1] = 1;
+    TEST(err, !munmap(arena, len));
+    arena = MAP_FAILED;
+CHECK(err):
+    if(arena != MAP_FAILED) {
+        munmap(arena, len);
+    }
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    toaster_mmap_faults(1);
+    assert(0 == toaster_run_errno_range(0, 100, test_reader));
+    assert(0 == toaster_run_errno_range(0, 100, test_arena));
+    toaster_mmap_faults(0);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * test_new.cpp
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define TOASTER_SHOW_LOG
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "toaster.hpp"
+
+static std::vector<std::string> gnames{"a", "b"};
+static toaster::failing_resource gupstream;
+static int ghandled;
+
+struct alignas(64) line {
+    char bytes[64];
+};
+
+/** builds an index and appends through it, push_back has to leave the names alone on a throw */
+static void append() {
+    std::map<int, std::string> index;
+    for(int i = 0; i < 4; ++i) {
+        index.emplace(i, std::string(32, 'x'));
+    }
+    gnames.push_back(index[0]);
+    gnames.pop_back();
+}
+
+static bool names() {
+    return gnames.size() == 2 && gnames[0] == "a" && gnames[1] == "b";
+}
+
+/** allocates with every form of new and reports a failure as a status */
+static int forms() {
+    try {
+        std::unique_ptr<int[]> ints(new int[64]);
+        std::unique_ptr<line> one(new line);
+        std::unique_ptr<line[]> many(new line[2]);
+        std::unique_ptr<int> nothrow(new(std::nothrow) int(1));
+        std::unique_ptr<line> aligned(new(std::nothrow) line);
+        assert(reinterpret_cast<std::uintptr_t>(one.get()) % alignof(line) == 0);
+        assert(reinterpret_cast<std::uintptr_t>(many.get()) % alignof(line) == 0);
+        return nothrow && aligned ? 0 : -1;
+    } catch(const std::bad_alloc &) {
+        return -1;
+    }
+}
+
+/** rows in an arena that grows from the failing resource */
+static void pipeline() {
+    std::pmr::monotonic_buffer_resource arena(256, &gupstream);
+    std::pmr::vector<std::pmr::string> rows(&arena);
+    for(int i = 0; i < 16; ++i) {
+        rows.emplace_back(64, 'x');
+    }
+}
+
+static int pipeline_status() {
+    try {
+        pipeline();
+        return 0;
+    } catch(const std::bad_alloc &) {
+        return -1;
+    }
+}
+
+static void handler() {
+    ++ghandled;
+    std::set_new_handler(nullptr);
+}
+
+/** a real failure goes through the new handler before it throws */
+static int exhaust(std::size_t huge) {
+    void *p = nullptr;
+    std::set_new_handler(handler);
+    try {
+        p = ::operator new(huge);
+    } catch(const std::bad_alloc &) {
+    }
+    ::operator delete(p);
+    return p ? 0 : -1;
+}
+
+int main(int _argc, char * const _argv[]) {
+    volatile std::size_t huge = SIZE_MAX / 4;
+    long long baseline;
+
+    /** room for the append, so the capacity it would keep does not count */
+    gnames.reserve(3);
+    baseline = toaster_new_live();
+
+    toaster_new_faults(1);
+    assert(0 == toaster::run_throwing(0, 1000, append, names));
+    assert(0 == toaster::run(0, 100, forms));
+    toaster_new_faults(0);
+    assert(toaster_new_live() == baseline);
+
+    assert(0 == toaster::run_throwing(0, 100, pipeline, [] { return gupstream.live() == 0; }));
+    assert(0 == toaster::run(0, 100, pipeline_status));
+    assert(gupstream.live() == 0 && gupstream.allocations() > 0);
+
+    assert(-1 == exhaust(huge) && ghandled == 1);
+    assert(!::operator new(huge, std::nothrow));
+    assert(toaster_new_live() == baseline);
+    return 0;
+}
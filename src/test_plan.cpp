@@ -0,0 +1,69 @@
+/**
+ * test_plan.cpp
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define TOASTER_SHOW_LOG
+#include <cassert>
+#include <cstdint>
+
+/** the targeted build, only the second write is swept */
+#define TOASTER_PLAN stress_plan
+#include "toaster.hpp"
+
+/** the line of the second write, its site is the file, this line and the expression */
+#define SECOND_WRITE 49
+using stress_plan =
+    toaster::plan<toaster::site_id(__FILE__ ":" TOASTER_STR(SECOND_WRITE) ":write(2)")>;
+
+static int gwrites;
+static int gruns;
+
+static bool write(int n) {
+    gwrites += n;
+    return true;
+}
+
+static int save() {
+    int err = 0;
+    ++gruns;
+    TOASTER_TEST(err, write(1));
+    TOASTER_TEST(err, write(2));
+    static_assert(__LINE__ - 1 == SECOND_WRITE, "SECOND_WRITE is the line of the write(2) site");
+    TOASTER_TEST(err, write(4));
+CHECK(err):
+    return err;
+}
+
+static_assert(toaster::site_id("") == 0xcbf29ce484222325ULL);
+static_assert(toaster::site_id("a") == 0xaf63dc4c8601ec8cULL);
+static_assert(!toaster::plan<>::targets(0));
+static_assert(toaster::every_site::targets(0));
+
+int main(int _argc, char * const _argv[]) {
+    /** one targeted site, one failing iteration, the other two never reach the runtime */
+    assert(0 == toaster::run(0, 100, save));
+    assert(gruns == 2);
+    assert(gwrites == 1 + 7);
+    /** the untargeted sites are not even registered */
+    assert(toaster_site_count() == 1);
+    return 0;
+}
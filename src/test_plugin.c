@@ -0,0 +1,92 @@
+/**
+ * test_plugin.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "toaster.h"
+
+/**
+ * a codec plugin with its own TEST sites and its own copy of toaster.o,
+ * built into cov/libtest_plugin.so with TEST_PLUGIN_LIB
+ */
+#define PLUGIN_SITES 3
+
+#ifdef TEST_PLUGIN_LIB
+int plugin_decode(const char *in, char **out) {
+    int err = 0;
+    size_t i, len;
+    char *buf = 0;
+    TEST(err, in != 0);
+    len = strlen(in);
+    TEST(err, len < 64);
+    buf = malloc(len + 1);
+    TEST(err, buf != 0);
+    for(i = 0; i <= len; ++i) {
+        buf[i] = toupper(in[i]);
+    }
+    *out = buf;
+    buf = 0;
+CHECK(err):
+    free(buf);
+    return err;
+}
+#else
+static int (*gdecode)(const char *, char **);
+static int gfailed;
+
+int test_host(void) {
+    int err = 0;
+    char *out = 0;
+    int rv = gdecode("abc", &out);
+    gfailed += rv != 0;
+    TEST(err, !rv);
+    TEST(err, !strcmp(out, "ABC"));
+CHECK(err):
+    free(out);
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    int host = toaster_site_count();
+    void *plugin;
+    assert(host == 2);
+    plugin = dlopen("cov/libtest_plugin.so", RTLD_NOW);
+    assert(plugin);
+    assert(toaster_site_count() == host + PLUGIN_SITES);
+    assert(strstr(toaster_site_at(host), "test_plugin.c"));
+    assert(!toaster_site_at(host + PLUGIN_SITES));
+    *(void **)&gdecode = dlsym(plugin, "plugin_decode");
+    /** the plugin's sites are numbered between the host's */
+    assert(0 == toaster_run_range(0, 100, test_host));
+    assert(gfailed == PLUGIN_SITES);
+    dlclose(plugin);
+    assert(toaster_site_count() == host);
+    return 0;
+}
+#endif
@@ -0,0 +1,189 @@
+/**
+ * test_poll.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "toaster.h"
+
+#define LOOPS 8
+
+/** the second pipe only becomes ready after the first one was read */
+static int late(int b[2], int got) {
+    return got != 5 || 5 == write(b[1], "world", 5);
+}
+
+/** read until the pipe would block, spurious wakeups read nothing */
+static int drain(int fd) {
+    char buf[16];
+    int got = 0;
+    ssize_t n;
+    while(0 < (n = read(fd, buf, sizeof(buf)))) {
+        got += n;
+    }
+    return got;
+}
+
+static int pipes(int a[2], int b[2]) {
+    int err = 0;
+    TEST(err, !pipe2(a, O_NONBLOCK));
+    TEST(err, !pipe2(b, O_NONBLOCK));
+    TEST(err, 5 == write(a[1], "hello", 5));
+CHECK(err):
+    return err;
+}
+
+static void close_pipes(int a[2], int b[2]) {
+    int i;
+    for(i = 0; i < 2; ++i) {
+        if(a[i] != -1) {
+            close(a[i]);
+        }
+        if(b[i] != -1) {
+            close(b[i]);
+        }
+    }
+}
+
+/**
+ * edge triggered reactor over two pipes, a timeout rereads every fd
+ * so a lost edge costs one timeout instead of hanging, and it never spins
+ */
+int test_epoll(void) {
+    int err = 0;
+    int ep = -1;
+    int a[2] = {-1, -1}, b[2] = {-1, -1};
+    int i, n, got = 0, loops = 0;
+    struct epoll_event ev, evs[4];
+    TEST(err, !pipes(a, b));
+    ep = epoll_create1(0);
+    TEST(err, ep >= 0);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = a[0];
+    TEST(err, !epoll_ctl(ep, EPOLL_CTL_ADD, a[0], &ev));
+    ev.data.u64 = b[0];
+    TEST(err, !epoll_ctl(ep, EPOLL_CTL_ADD, b[0], &ev));
+    while(got < 10) {
+        TEST(err, ++loops < LOOPS);
+        n = epoll_wait(ep, evs, 4, 100);
+        TEST(err, n >= 0 || errno == EINTR);
+        if(n == 0) {
+            evs[0].data.u64 = a[0];
+            evs[1].data.u64 = b[0];
+            n = 2;
+        }
+        for(i = 0; i < n; ++i) {
+            got += drain((int)evs[i].data.u64);
+        }
+        TEST(err, late(b, got));
+    }
+    TEST(err, !epoll_ctl(ep, EPOLL_CTL_DEL, b[0], 0));
+CHECK(err):
+    if(ep != -1) {
+        close(ep);
+    }
+    close_pipes(a, b);
+    return err;
+}
+
+/**
+ * an fd closed without EPOLL_CTL_DEL leaves its epoll set, a spurious event
+ * must never name it, while an fd that is still open can be picked
+ */
+int test_closed(void) {
+    int err = 0;
+    int ep = -1;
+    int a[2] = {-1, -1}, b[2] = {-1, -1};
+    int i, n;
+    struct epoll_event ev, evs[4];
+    TEST(err, !pipe(a));
+    TEST(err, !pipe(b));
+    ep = epoll_create1(0);
+    TEST(err, ep >= 0);
+    ev.events = EPOLLIN;
+    ev.data.u64 = 42;
+    TEST(err, !epoll_ctl(ep, EPOLL_CTL_ADD, a[0], &ev));
+    close(a[0]);
+    close(a[1]);
+    ev.data.u64 = 7;
+    TEST(err, !epoll_ctl(ep, EPOLL_CTL_ADD, b[0], &ev));
+    n = epoll_wait(ep, evs, 4, 0);
+    TEST(err, n >= 0 || errno == EINTR);
+    for(i = 0; i < n; ++i) {
+        assert(evs[i].data.u64 != 42);
+    }
+CHECK(err):
+    if(ep != -1) {
+        close(ep);
+    }
+    if(b[0] != -1) {
+        close(b[0]);
+        close(b[1]);
+    }
+    return err;
+}
+
+/** the same reactor on level triggered poll */
+int test_poll(void) {
+    int err = 0;
+    int a[2] = {-1, -1}, b[2] = {-1, -1};
+    int i, n, got = 0, loops = 0;
+    struct pollfd fds[3] = {{-1}, {-1}, {-1}};
+    TEST(err, !pipes(a, b));
+    fds[0].fd = a[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = b[0];
+    fds[1].events = POLLIN;
+    while(got < 10) {
+        TEST(err, ++loops < LOOPS);
+        n = poll(fds, 3, 100);
+        TEST(err, n >= 0 || errno == EINTR);
+        for(i = 0; n > 0 && i < 2; ++i) {
+            if(fds[i].revents & POLLIN) {
+                got += drain(fds[i].fd);
+            }
+        }
+        TEST(err, late(b, got));
+    }
+CHECK(err):
+    close_pipes(a, b);
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    toaster_vtime_enable(1);
+    toaster_poll_faults(1);
+    assert(0 == toaster_run_errno_range(0, 100, test_epoll));
+    assert(0 == toaster_run_errno_range(0, 100, test_poll));
+    assert(0 == toaster_run_errno_range(0, 100, test_closed));
+    toaster_poll_faults(0);
+    toaster_vtime_enable(0);
+    assert(0 == toaster_run(test_epoll));
+    return 0;
+}
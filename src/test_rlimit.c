@@ -0,0 +1,107 @@
+/**
+ * test_rlimit.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "toaster.h"
+
+#define FILES 8
+#define MB (1 << 20)
+
+/** hold FILES descriptors at once */
+int test_files(void) {
+    int err = 0;
+    int fds[FILES];
+    int i, opened = 0;
+    for(i = 0; i < FILES; ++i) {
+        fds[i] = open("/dev/null", O_RDONLY);
+        TEST(err, fds[i] >= 0);
+        ++opened;
+    }
+CHECK(err):
+    for(i = 0; i < opened; ++i) {
+        close(fds[i]);
+    }
+    return err;
+}
+
+/** forgets the first descriptor when the second one fails */
+int test_leaky(void) {
+    int err = 0;
+    int a = open("/dev/null", O_RDONLY);
+    int b = -1;
+    TEST(err, a >= 0);
+    b = open("/dev/null", O_RDONLY);
+    TEST(err, b >= 0);
+    close(a);
+    close(b);
+CHECK(err):
+    return err;
+}
+
+/** write a 4k file, past RLIMIT_FSIZE the write comes up short or fails with EFBIG */
+int test_log(void) {
+    int err = 0;
+    char buf[4096];
+    int fd = open("/tmp/toaster_rlimit", O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    memset(buf, 'x', sizeof(buf));
+    TEST(err, fd >= 0);
+    TEST(err, sizeof(buf) == write(fd, buf, sizeof(buf)));
+CHECK(err):
+    if(fd != -1) {
+        close(fd);
+    }
+    unlink("/tmp/toaster_rlimit");
+    return err;
+}
+
+/** a buffer that has to be touched */
+int test_buffer(void) {
+    int err = 0;
+    char *buf = malloc(64 * MB);
+    TEST(err, buf != 0);
+    memset(buf, 1, 64 * MB);
+CHECK(err):
+    free(buf);
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    long long lim;
+    int base = dup(0);
+    close(base);
+    lim = toaster_rlimit_run_range(RLIMIT_NOFILE, 0, 64, 1, test_files);
+    assert(lim >= base + FILES && lim <= 64);
+    assert(-1 == toaster_rlimit_run_range(RLIMIT_NOFILE, 0, 64, 1, test_leaky));
+    assert(4096 == toaster_rlimit_run_range(RLIMIT_FSIZE, 0, 8192, 1024, test_log));
+    lim = toaster_rlimit_run_range(RLIMIT_AS, 0, 4096LL * MB, 16 * MB, test_buffer);
+    assert(lim > 64 * MB);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * test_thread.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "toaster.h"
+
+#define WORKERS 4
+
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    sem_t ready;
+    pthread_t threads[WORKERS];
+    int started;
+    int stop;
+};
+
+static void *worker(void *arg) {
+    struct pool *p = arg;
+    sem_post(&p->ready);
+    pthread_mutex_lock(&p->lock);
+    while(!p->stop) {
+        pthread_cond_wait(&p->cond, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+/** stop and join every worker that started */
+static void pool_stop(struct pool *p) {
+    int i;
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    for(i = 0; i < p->started; ++i) {
+        pthread_join(p->threads[i], 0);
+    }
+}
+
+/** start WORKERS threads and wait until they run, or leave nothing behind */
+int pool_start(struct pool *p) {
+    int err = 0;
+    int lock = 0, cond = 0, ready = 0, attr_ok = 0;
+    int i;
+    pthread_attr_t attr;
+    struct timespec deadline;
+    p->started = 0;
+    p->stop = 0;
+    TEST(err, !pthread_mutex_init(&p->lock, 0));
+    lock = 1;
+    TEST(err, !pthread_cond_init(&p->cond, 0));
+    cond = 1;
+    TEST(err, !sem_init(&p->ready, 0, 0));
+    ready = 1;
+    TEST(err, !pthread_attr_init(&attr));
+    attr_ok = 1;
+    TEST(err, !pthread_attr_setstacksize(&attr, 256 * 1024));
+    TEST(err, !pthread_attr_setguardsize(&attr, 4096));
+    TEST(err, !pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE));
+    for(i = 0; i < WORKERS; ++i) {
+        TEST(err, !pthread_create(&p->threads[i], &attr, worker, p));
+        ++p->started;
+    }
+    TEST(err, !clock_gettime(CLOCK_REALTIME, &deadline));
+    deadline.tv_sec += 10;
+    for(i = 0; i < WORKERS; ++i) {
+        TEST(err, !sem_timedwait(&p->ready, &deadline));
+    }
+CHECK(err):
+    if(attr_ok) {
+        pthread_attr_destroy(&attr);
+    }
+    if(err && lock && cond) {
+        pool_stop(p);
+    }
+    if(err && ready) {
+        sem_destroy(&p->ready);
+    }
+    if(err && cond) {
+        pthread_cond_destroy(&p->cond);
+    }
+    if(err && lock) {
+        pthread_mutex_destroy(&p->lock);
+    }
+    return err;
+}
+
+int test_pool(void) {
+    int err = 0;
+    struct pool p;
+    sem_t *named = SEM_FAILED;
+    TEST(err, !pool_start(&p));
+    pool_stop(&p);
+    sem_destroy(&p.ready);
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+    named = sem_open("/toaster_test", O_CREAT, 0600, 1);
+    TEST(err, named != SEM_FAILED);
+    TEST(err, !sem_wait(named));
+    TEST(err, !sem_post(named));
+CHECK(err):
+    if(named != SEM_FAILED) {
+        sem_close(named);
+        sem_unlink("/toaster_test");
+    }
+    assert(toaster_thread_live() == 0);
+    return err;
+}
+
+static void limit(int i) {
+    toaster_thread_limit(i);
+}
+
+int main(int _argc, char * const _argv[]) {
+    toaster_thread_faults(1);
+    assert(0 == toaster_run_errno_range(0, 100, test_pool));
+    toaster_thread_faults(0);
+    /** the pool needs exactly WORKERS threads */
+    assert(0 == toaster_run_with(0, WORKERS, limit, test_pool));
+    assert(toaster_get() == -1);
+    toaster_thread_limit(-1);
+    return 0;
+}
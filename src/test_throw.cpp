@@ -0,0 +1,168 @@
+/**
+ * test_throw.cpp
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define TOASTER_SHOW_LOG
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <system_error>
+
+#include "toaster.hpp"
+
+static int glive;
+static bool gstrong = true;
+
+/** every construction is a site, like an allocation in a real element type */
+struct tracked {
+    std::string name;
+    explicit tracked(const char *n) : name((toaster_check_site("tracked"), n)) {
+        ++glive;
+    }
+    tracked(const tracked &o) : name((toaster_check_site("tracked:copy"), o.name)) {
+        ++glive;
+    }
+    tracked &operator=(const tracked &) = delete;
+    ~tracked() {
+        --glive;
+    }
+};
+
+/** a vector that grows by copying into a new buffer, `leaky` forgets the buffer on a throw */
+template <class T, bool leaky = false>
+class stack {
+public:
+    stack() = default;
+    stack(const stack &) = delete;
+    ~stack() {
+        clear(data_, len_);
+        ::operator delete(data_);
+    }
+    size_t size() const {
+        return len_;
+    }
+    const T &operator[](size_t i) const {
+        return data_[i];
+    }
+    /** strong guarantee, a throw leaves the stack as it was */
+    void push(const T &v) {
+        size_t cap = len_ == cap_ ? (cap_ ? 2 * cap_ : 2) : cap_;
+        T *data = cap == cap_ ? data_ : allocate(cap);
+        size_t i = cap == cap_ ? len_ : 0;
+        try {
+            for(; data != data_ && i < len_; ++i) {
+                new(&data[i]) T(data_[i]);
+            }
+            new(&data[len_]) T(v);
+        } catch(...) {
+            if(data != data_) {
+                clear(data, i);
+                if(!leaky) {
+                    ::operator delete(data);
+                }
+            }
+            throw;
+        }
+        if(data != data_) {
+            clear(data_, len_);
+            ::operator delete(data_);
+            data_ = data;
+            cap_ = cap;
+        }
+        ++len_;
+    }
+
+private:
+    static T *allocate(size_t n) {
+        /** the thrower raises std::bad_alloc from the site itself */
+        toaster_check_site("stack:allocate");
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    static void clear(T *data, size_t n) {
+        while(n) {
+            data[--n].~T();
+        }
+    }
+    T *data_ = 0;
+    size_t len_ = 0;
+    size_t cap_ = 0;
+};
+
+/** fill past a growth, then check the strong guarantee of the push that may throw */
+template <bool leaky>
+static void fill() {
+    stack<tracked, leaky> s;
+    size_t before;
+    s.push(tracked("a"));
+    s.push(tracked("b"));
+    before = s.size();
+    try {
+        s.push(tracked("c"));
+    } catch(...) {
+        gstrong = s.size() == before && s[0].name == "a" && s[1].name == "b";
+        throw;
+    }
+}
+
+static bool invariant() {
+    return gstrong && glive == 0;
+}
+
+/** a config loader whose open site throws std::system_error */
+static std::string load() {
+    std::string path = "/tmp/toaster_config";
+    toaster_check_site("open");
+    return path;
+}
+
+int main(int _argc, char * const _argv[]) {
+    assert(0 == toaster::run_throwing<std::bad_alloc>(0, 100, fill<false>, invariant));
+    assert(-1 == toaster::run_throwing<std::bad_alloc>(0, 100, fill<true>, invariant));
+    /** still throwing when the counter runs out is not a pass */
+    assert(-1 == toaster::run_throwing<std::bad_alloc>(0, 2, fill<false>, invariant));
+    assert(0 == toaster::run_throwing<std::system_error>(0, 100, load, invariant));
+    assert(toaster::injected_exception<std::system_error>::make(0).code() == std::errc::io_error);
+    /** without a thrower the action fails the check */
+    toaster_set_action(TOASTER_ACTION_THROW);
+    toaster_set(0);
+    assert(toaster_check_site("no thrower"));
+    toaster_end();
+    /** the malloc mock fails with NULL instead of throwing through C frames */
+    toaster_set_thrower(toaster::detail::thrower<std::bad_alloc>);
+    toaster_malloc_faults(1);
+    toaster_set(0);
+    assert(!malloc(8));
+    toaster_end();
+    toaster_malloc_faults(0);
+    toaster_set_thrower(nullptr);
+    toaster_set_action(TOASTER_ACTION_FAIL);
+    gstrong = false;
+    assert(-1 == toaster::run_throwing(0, 100, fill<false>, invariant));
+    /** a broken invariant is caught with parallel workers asked for as well */
+    gstrong = true;
+    toaster_set_jobs(2);
+    assert(-1 == toaster::run_throwing<std::bad_alloc>(0, 100, fill<true>, invariant));
+    assert(2 == toaster_set_jobs(1));
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * test_time.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include "toaster.h"
+
+#define NSEC 1000000000LL
+
+static long long ns_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * NSEC + (now.tv_nsec - start->tv_nsec);
+}
+
+/** poll with a 1s timeout and exponential backoff, 36s in total before giving up */
+int wait_readable(int fd) {
+    int err = 0;
+    int i;
+    struct pollfd p = {fd, POLLIN, 0};
+    for(i = 0; i < 5 && !poll(&p, 1, 1000); ++i) {
+        sleep(1 << i);
+    }
+    TEST(err, i < 5);
+CHECK(err):
+    return err;
+}
+
+int test_timeouts(void) {
+    int err = 0;
+    int fds[2] = {-1, -1};
+    int ep = -1;
+    struct timespec start, ts = {0, 500000000};
+    struct timeval tv = {2, 0}, tod;
+    struct epoll_event ev = {};
+    fd_set rd;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST(err, !pipe(fds));
+    TEST(err, wait_readable(fds[0]));
+    TEST(err, ns_since(&start) == 36 * NSEC);
+    TEST(err, !usleep(250000));
+    TEST(err, !nanosleep(&ts, 0));
+    TEST(err, ns_since(&start) == 36 * NSEC + 750000000);
+    FD_ZERO(&rd);
+    FD_SET(fds[0], &rd);
+    TEST(err, !select(fds[0] + 1, &rd, 0, 0, &tv));
+    TEST(err, !tv.tv_sec && !tv.tv_usec);
+    ep = epoll_create1(0);
+    TEST(err, ep >= 0);
+    ev.events = EPOLLIN;
+    TEST(err, !epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &ev));
+    TEST(err, !epoll_wait(ep, &ev, 1, 250));
+    TEST(err, ns_since(&start) == 39 * NSEC);
+    ts.tv_sec = start.tv_sec + 40;
+    ts.tv_nsec = start.tv_nsec;
+    TEST(err, !clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0));
+    TEST(err, !gettimeofday(&tod, 0));
+    TEST(err, toaster_vtime_ns() == 40 * NSEC);
+    TEST(err, 1 == write(fds[1], "x", 1));
+    TEST(err, !wait_readable(fds[0]));
+    TEST(err, 1 == poll(&(struct pollfd){fds[0], POLLIN, 0}, 1, 1000));
+    TEST(err, 1 == epoll_wait(ep, &ev, 1, 1000));
+    TEST(err, ns_since(&start) == 40 * NSEC);
+CHECK(err):
+    if(ep != -1) {
+        close(ep);
+    }
+    if(fds[0] != -1) {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    return err;
+}
+
+int main(int _argc, char * const _argv[]) {
+    struct timespec start;
+    struct timespec ts = {0, 1000};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    toaster_vtime_enable(1);
+    assert(toaster_vtime_enabled());
+    assert(0 == toaster_run_max(100, test_timeouts));
+    toaster_vtime_enable(0);
+    /** 100 iterations of 40s of timeouts in well under a second of wall time */
+    assert(ns_since(&start) < NSEC);
+    assert(!usleep(1) && !nanosleep(&ts, 0) && !sleep(0));
+    assert(0 == poll(0, 0, 1));
+    return 0;
+}
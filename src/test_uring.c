@@ -0,0 +1,187 @@
+/**
+ * test_uring.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <linux/io_uring.h>
+
+#include "toaster.h"
+
+/**
+ * a ring that completes every request in full on submit, standing in for liburing,
+ * built into cov/libtest_uring.so with TEST_URING_LIB
+ */
+#define RING 8
+
+struct io_uring {
+    struct io_uring_cqe cqes[RING];
+    unsigned head;
+    unsigned tail;
+    struct io_uring_cqe queued[RING];
+    unsigned nqueued;
+};
+
+void test_uring_prep(struct io_uring *ring, unsigned long long data, int len);
+void test_uring_seen(struct io_uring *ring);
+int io_uring_submit(struct io_uring *ring);
+int io_uring_submit_and_wait(struct io_uring *ring, unsigned wait_nr);
+int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
+                       unsigned submit, unsigned wait_nr, sigset_t *sigmask);
+unsigned io_uring_peek_batch_cqe(struct io_uring *ring, struct io_uring_cqe **cqes,
+                                 unsigned count);
+
+#ifdef TEST_URING_LIB
+void test_uring_prep(struct io_uring *ring, unsigned long long data, int len) {
+    ring->queued[ring->nqueued].user_data = data;
+    ring->queued[ring->nqueued].res = len;
+    ring->queued[ring->nqueued].flags = 0;
+    ++ring->nqueued;
+}
+
+void test_uring_seen(struct io_uring *ring) {
+    ++ring->head;
+}
+
+int io_uring_submit(struct io_uring *ring) {
+    unsigned i, n = ring->nqueued;
+    for(i = 0; i < n; ++i) {
+        ring->cqes[ring->tail++ % RING] = ring->queued[i];
+    }
+    ring->nqueued = 0;
+    return n;
+}
+
+int io_uring_submit_and_wait(struct io_uring *ring, unsigned wait_nr) {
+    return io_uring_submit(ring);
+}
+
+int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
+                       unsigned submit, unsigned wait_nr, sigset_t *sigmask) {
+    if(ring->head == ring->tail) {
+        return -EAGAIN;
+    }
+    *cqe_ptr = &ring->cqes[ring->head % RING];
+    return 0;
+}
+
+unsigned io_uring_peek_batch_cqe(struct io_uring *ring, struct io_uring_cqe **cqes,
+                                 unsigned count) {
+    unsigned n;
+    for(n = 0; n < count && ring->head + n != ring->tail; ++n) {
+        cqes[n] = &ring->cqes[(ring->head + n) % RING];
+    }
+    return n;
+}
+#else
+#define BLOCK 4096
+#define BLOCKS 4
+#define RETRIES 3
+
+static int retryable(int res) {
+    return res == -EAGAIN || res == -EBUSY || res == -EINTR;
+}
+
+/** submit, retrying a busy ring a few times */
+int submit(struct io_uring *ring) {
+    int err = 0;
+    int rv, tries = 0;
+    while(retryable(rv = io_uring_submit(ring)) && ++tries < RETRIES) {
+    }
+    TEST(err, rv >= 0);
+CHECK(err):
+    return err;
+}
+
+/**
+ * read BLOCKS blocks, resubmitting what is left of short and interrupted completions
+ */
+int test_uring(void) {
+    int err = 0;
+    struct io_uring ring = {};
+    struct io_uring_cqe *cqe;
+    struct io_uring_cqe *batch[RING];
+    unsigned long long left[BLOCKS];
+    int i, done = 0, retries = 0;
+    unsigned n;
+    for(i = 0; i < BLOCKS; ++i) {
+        left[i] = BLOCK;
+        test_uring_prep(&ring, i, BLOCK);
+    }
+    TEST(err, !submit(&ring));
+    /** the first completion comes from a batch peek */
+    n = io_uring_peek_batch_cqe(&ring, batch, 1);
+    TEST(err, n == 1);
+    cqe = batch[0];
+    while(done < BLOCKS) {
+        i = (int)cqe->user_data;
+        if(cqe->res < 0) {
+            TEST(err, retryable(cqe->res) && ++retries < RETRIES);
+            test_uring_prep(&ring, i, left[i]);
+        } else if(cqe->res < left[i]) {
+            left[i] -= cqe->res;
+            test_uring_prep(&ring, i, left[i]);
+        } else {
+            ++done;
+        }
+        test_uring_seen(&ring);
+        TEST(err, !submit(&ring));
+        if(done < BLOCKS) {
+            TEST(err, !__io_uring_get_cqe(&ring, &cqe, 0, 1, 0));
+        }
+    }
+    TEST(err, io_uring_submit_and_wait(&ring, 0) == 0);
+CHECK(err):
+    return err;
+}
+
+static struct io_uring_cqe gcqe = {0, 8, 0};
+
+/** the first completion of an iteration, at the address the last one ended on */
+int test_same_cqe(void) {
+    gcqe.res = 8;
+    return toaster_uring_cqe(&gcqe) ? -1 : 0;
+}
+
+int main(int _argc, char * const _argv[]) {
+    toaster_uring_faults(TOASTER_URING_FAULTS);
+    assert(0 == toaster_run_errno_range(0, 1000, test_uring));
+    toaster_set(0);
+    assert(1 == toaster_uring_cqe(&gcqe) && gcqe.res == 4);
+    assert(0 == toaster_uring_cqe(&gcqe));
+    toaster_end();
+    assert(-1 == toaster_run_range(0, 0, test_same_cqe) && gcqe.res == 4);
+    /** without TOASTER_URING_SHORT a result, which may be an fd, is never halved */
+    toaster_uring_faults(TOASTER_URING_ERRORS);
+    assert(0 == toaster_run_errno_range(0, 1000, test_uring));
+    assert(-1 == toaster_run_range(0, 0, test_same_cqe) && gcqe.res < 0);
+    toaster_uring_faults(TOASTER_URING_SHORT);
+    assert(0 == toaster_run(test_uring));
+    assert(-1 == toaster_run_range(0, 0, test_same_cqe) && gcqe.res == 4);
+    toaster_uring_faults(0);
+    assert(0 == toaster_run(test_uring));
+    return 0;
+}
+#endif
@@ -22,23 +22,499 @@
  */
 #define _GNU_SOURCE
 #define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <link.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "toaster.h"
 
+struct latency {
+    const char *site;
+    struct toaster_latency lat;
+};
+
+struct range {
+    uintptr_t lo;
+    uintptr_t hi;
+};
+
+struct sites {
+    const char *const *start;
+    const char *const *stop;
+};
+
 static int gcnt;
 static int gset;
+static int gspent;
+static int ginjected;
+static int gslot;
+static int gslots;
+static int gjobs = 1;
+static enum toaster_action gaction = TOASTER_ACTION_FAIL;
+static void (*gthrower)(const char *site);
+static double gprob;
+static unsigned gseed;
+static uint64_t grand = 1;
+static const char *gsite;
+static long gdelayed_us;
+static struct latency *glatencies;
+static int glatencies_len;
+static struct toaster_latency gdefault_latency = {TOASTER_DIST_FIXED, 1000, 1000, 0};
+static void (*gresets[TOASTER_MAX_RESETS])(void);
+static int gresets_len;
+static void (*gdones[TOASTER_MAX_RESETS])(int cnt, int err);
+static int gdones_len;
+static int gfailures;
+static struct range gfilters[TOASTER_MAX_FILTERS];
+static int gfilters_len;
+static struct sites gmodules[TOASTER_MAX_MODULES];
+static int gcontexts;
+static unsigned long giteration;
+static __thread unsigned long tcontext;
+static int gmodules_len;
+
+static double rand_unit(void) {
+    /** xorshift64*, (0, 1] */
+    grand ^= grand >> 12;
+    grand ^= grand << 25;
+    grand ^= grand >> 27;
+    return ((grand * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0) +
+           (1.0 / 9007199254740992.0);
+}
+
+static const struct toaster_latency *latency_of(const char *site) {
+    int i;
+    for(i = 0; site && i < glatencies_len; ++i) {
+        if(glatencies[i].site == site || !strcmp(glatencies[i].site, site)) {
+            return &glatencies[i].lat;
+        }
+    }
+    return &gdefault_latency;
+}
+
+static long sample_us(const struct toaster_latency *lat) {
+    double us = lat->min_us;
+    switch(lat->dist) {
+    case TOASTER_DIST_FIXED:
+        break;
+    case TOASTER_DIST_UNIFORM:
+        us += (lat->max_us - lat->min_us) * rand_unit();
+        break;
+    case TOASTER_DIST_PARETO:
+        us = lat->min_us * pow(rand_unit(), -1.0 / lat->alpha);
+        break;
+    }
+    if(lat->max_us > lat->min_us && us > lat->max_us) {
+        us = lat->max_us;
+    }
+    /** an uncapped pareto tail can pass what a long holds */
+    return us < LONG_MAX ? (long)us : LONG_MAX;
+}
+
+static void delay(const char *site) {
+    long us = sample_us(latency_of(site));
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    TOASTER_LOG("delay %ldus: %s", us, site ? site : "?");
+    gdelayed_us += us;
+    while(nanosleep(&ts, &ts) && errno == EINTR) {
+    }
+}
+
+static int inject(const char *site, int nothrow) {
+    toaster_injected(site);
+    if(gaction == TOASTER_ACTION_DELAY) {
+        delay(site);
+        return 0;
+    }
+    if(gaction == TOASTER_ACTION_THROW && gthrower && !nothrow) {
+        TOASTER_LOG("throw: %s", site ? site : "?");
+        gthrower(site);
+    }
+    return -1;
+}
+
+static int filtered(const void *caller) {
+    uintptr_t pc = (uintptr_t)caller;
+    int i;
+    if(gcontexts && tcontext != __atomic_load_n(&giteration, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+    if(!gfilters_len || !caller) {
+        return 0;
+    }
+    for(i = 0; i < gfilters_len; ++i) {
+        if(pc >= gfilters[i].lo && pc < gfilters[i].hi) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int check(const char *site, const void *caller, int nothrow) {
+    if(filtered(caller)) {
+        return 0;
+    }
+    if(gprob > 0 && rand_unit() <= gprob) {
+        return inject(site, nothrow);
+    }
+    if(gset && !gspent) {
+        /** failures stick once the counter runs out, delays and throws fire once */
+        int cnt = __atomic_sub_fetch(&gcnt, 1, __ATOMIC_RELAXED);
+        if(cnt == -1 || (cnt < 0 && gaction == TOASTER_ACTION_FAIL)) {
+            return inject(site, nothrow);
+        }
+    }
+    return 0;
+}
+
+int toaster_check_from(const char *site, const void *caller) {
+    return check(site, caller, 0);
+}
+
+int toaster_check_nothrow_from(const char *site, const void *caller) {
+    return check(site, caller, 1);
+}
+
+int toaster_check_site(const char *site) {
+    return toaster_check_from(site, 0);
+}
 
 int toaster_check(void) {
-   if(gset && --gcnt < 0) {
-       return -1;
-   }
-   return 0;
+    return toaster_check_site(0);
 }
 
-void toaster_set(int cnt) {
+int toaster_check_once_from(const char *site, const void *caller) {
+    if(filtered(caller)) {
+        return 0;
+    }
+    if(gprob > 0 && rand_unit() <= gprob) {
+        return inject(site, 0);
+    }
+    if(gset && !gspent && __atomic_sub_fetch(&gcnt, 1, __ATOMIC_RELAXED) == -1) {
+        gspent = 1;
+        return inject(site, 0);
+    }
+    return 0;
+}
+
+int toaster_check_once(const char *site) {
+    return toaster_check_once_from(site, 0);
+}
+
+static int add_filter(uintptr_t lo, uintptr_t hi) {
+    if(gfilters_len == TOASTER_MAX_FILTERS) {
+        return -1;
+    }
+    gfilters[gfilters_len].lo = lo;
+    gfilters[gfilters_len].hi = hi;
+    ++gfilters_len;
+    return 0;
+}
+
+#define SEGMENTS 16
+
+/** the loaded segments of the object that contains `pc` */
+struct module {
+    uintptr_t pc;
+    int objects;
+    int main;
+    int len;
+    struct range exec[SEGMENTS];
+    struct range all[SEGMENTS];
+};
+
+static int module_of(struct dl_phdr_info *info, size_t size, void *data) {
+    struct module *m = data;
+    const ElfW(Phdr) *ph;
+    uintptr_t lo;
+    int i, found = 0;
+    for(i = 0; i < info->dlpi_phnum && !found; ++i) {
+        ph = &info->dlpi_phdr[i];
+        lo = info->dlpi_addr + ph->p_vaddr;
+        found = ph->p_type == PT_LOAD && m->pc >= lo && m->pc < lo + ph->p_memsz;
+    }
+    m->main = found && !m->objects;
+    ++m->objects;
+    for(i = 0; i < info->dlpi_phnum && found && m->len < SEGMENTS; ++i) {
+        ph = &info->dlpi_phdr[i];
+        lo = info->dlpi_addr + ph->p_vaddr;
+        if(ph->p_type == PT_LOAD) {
+            m->all[m->len].lo = lo;
+            m->all[m->len].hi = lo + ph->p_memsz;
+            m->exec[m->len] = (ph->p_flags & PF_X) ? m->all[m->len] : (struct range){0, 0};
+            ++m->len;
+        }
+    }
+    return found;
+}
+
+static int find_module(const void *addr, struct module *m) {
+    memset(m, 0, sizeof(*m));
+    m->pc = (uintptr_t)addr;
+    return dl_iterate_phdr(module_of, m) == 1 ? 0 : -1;
+}
+
+static int in_module(const struct module *m, const void *addr) {
+    uintptr_t pc = (uintptr_t)addr;
+    int i;
+    for(i = 0; i < m->len; ++i) {
+        if(pc >= m->all[i].lo && pc < m->all[i].hi) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int toaster_filter_module(const void *addr) {
+    Dl_info info;
+    struct module m;
+    int i;
+    if(find_module(addr, &m)) {
+        return -1;
+    }
+    for(i = 0; i < m.len; ++i) {
+        if(m.exec[i].hi && add_filter(m.exec[i].lo, m.exec[i].hi)) {
+            return -1;
+        }
+    }
+    if(dladdr(addr, &info)) {
+        TOASTER_LOG("filter module: %s", info.dli_fname);
+    }
+    return 0;
+}
+
+int toaster_filter_function(const void *fn) {
+    Dl_info info;
+    const ElfW(Sym) *sym = 0;
+    if(!dladdr1(fn, &info, (void **)&sym, RTLD_DL_SYMENT) || !sym || !info.dli_saddr ||
+       (uintptr_t)fn >= (uintptr_t)info.dli_saddr + sym->st_size) {
+        return -1;
+    }
+    TOASTER_LOG("filter function: %s", info.dli_sname);
+    return add_filter((uintptr_t)info.dli_saddr, (uintptr_t)info.dli_saddr + sym->st_size);
+}
+
+void toaster_filter_clear(void) {
+    gfilters_len = 0;
+}
+
+int toaster_register_sites(const char *const *start, const char *const *stop) {
+    int i;
+    for(i = 0; i < gmodules_len; ++i) {
+        if(gmodules[i].start == start) {
+            return 0;
+        }
+    }
+    if(gmodules_len == TOASTER_MAX_MODULES) {
+        return -1;
+    }
+    gmodules[gmodules_len].start = start;
+    gmodules[gmodules_len].stop = stop;
+    ++gmodules_len;
+    TOASTER_LOG("registered %d sites", (int)(stop - start));
+    return 0;
+}
+
+void toaster_unload_module(const void *addr) {
+    struct module m;
+    int i, n;
+    if(find_module(addr, &m)) {
+        return;
+    }
+    for(i = 0, n = 0; i < gmodules_len; ++i) {
+        if(!in_module(&m, gmodules[i].start)) {
+            gmodules[n++] = gmodules[i];
+        }
+    }
+    gmodules_len = n;
+    for(i = 0, n = 0; i < gresets_len; ++i) {
+        if(!in_module(&m, (const void *)gresets[i])) {
+            gresets[n++] = gresets[i];
+        }
+    }
+    gresets_len = n;
+    for(i = 0, n = 0; i < gdones_len; ++i) {
+        if(!in_module(&m, (const void *)gdones[i])) {
+            gdones[n++] = gdones[i];
+        }
+    }
+    gdones_len = n;
+}
+
+int toaster_site_count(void) {
+    int i, n = 0;
+    for(i = 0; i < gmodules_len; ++i) {
+        n += (int)(gmodules[i].stop - gmodules[i].start);
+    }
+    return n;
+}
+
+const char *toaster_site_at(int i) {
+    int m;
+    for(m = 0; m < gmodules_len; ++m) {
+        if(i < gmodules[m].stop - gmodules[m].start) {
+            return gmodules[m].start[i];
+        }
+        i -= (int)(gmodules[m].stop - gmodules[m].start);
+    }
+    return 0;
+}
+
+/**
+ * a plugin that links its own copy of the runtime only shares the host's state if the
+ * host exports it, otherwise its sites are swept by nobody
+ */
+static void __attribute__((constructor)) init(void) {
+    struct module m;
+    Dl_info info;
+    void *active = dlsym(RTLD_DEFAULT, "toaster_check_from");
+    if(!find_module((void *)init, &m) && !m.main && (!active || in_module(&m, active)) &&
+       dladdr((void *)init, &info)) {
+        TOASTER_LOG("%s has its own runtime, link the host with -rdynamic", info.dli_fname);
+    }
+}
+
+void toaster_set_action(enum toaster_action action) {
+    gaction = action;
+}
+
+void toaster_set_thrower(void (*thrower)(const char *site)) {
+    gthrower = thrower;
+}
+
+/** toaster_malloc.o replaces this when it is linked */
+__attribute__((weak)) long long toaster_heap_live(void) {
+    return -1;
+}
+
+/** toaster_new.o replaces this when it is linked */
+__attribute__((weak)) long long toaster_new_live(void) {
+    return -1;
+}
+
+int toaster_set_latency(const char *site, const struct toaster_latency *lat) {
+    struct latency *latencies;
+    int i;
+    if(lat->dist == TOASTER_DIST_PARETO && !(lat->alpha > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(!site) {
+        gdefault_latency = *lat;
+        return 0;
+    }
+    for(i = 0; i < glatencies_len; ++i) {
+        if(!strcmp(glatencies[i].site, site)) {
+            glatencies[i].lat = *lat;
+            return 0;
+        }
+    }
+    latencies = realloc(glatencies, sizeof(*glatencies) * (glatencies_len + 1));
+    if(!latencies) {
+        return -1;
+    }
+    glatencies = latencies;
+    glatencies[glatencies_len].site = site;
+    glatencies[glatencies_len].lat = *lat;
+    ++glatencies_len;
+    return 0;
+}
+
+void toaster_set_probability(double p, unsigned seed) {
+    gprob = p;
+    gseed = seed;
+    grand = (uint64_t)seed * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+int toaster_errno(const int *errnos, int n) {
+    int slot = 0;
+    /** only the first injected failure sweeps its errno table */
+    if(ginjected == 1 && !gslots) {
+        gslots = n;
+        if(gslot < n) {
+            slot = gslot;
+        }
+    }
+    errno = errnos[slot];
+    return errno;
+}
+
+int toaster_on_reset(void (*reset)(void)) {
+    if(gresets_len == TOASTER_MAX_RESETS) {
+        return -1;
+    }
+    gresets[gresets_len++] = reset;
+    return 0;
+}
+
+int toaster_on_done(void (*done)(int cnt, int err)) {
+    if(gdones_len == TOASTER_MAX_RESETS) {
+        return -1;
+    }
+    gdones[gdones_len++] = done;
+    return 0;
+}
+
+void toaster_fail(const char *why) {
+    const char *site = toaster_injected_site();
+    TOASTER_LOG("failed: %s, site %s", why, site ? site : "none");
+    __atomic_add_fetch(&gfailures, 1, __ATOMIC_RELAXED);
+}
+
+int toaster_failures(void) {
+    return __atomic_load_n(&gfailures, __ATOMIC_RELAXED);
+}
+
+static void finish(int cnt, int err) {
+    int i;
+    for(i = 0; i < gdones_len; ++i) {
+        gdones[i](cnt, err);
+    }
+}
+
+static void begin(int cnt) {
+    int i;
+    for(i = 0; i < gresets_len; ++i) {
+        gresets[i]();
+    }
+    __atomic_add_fetch(&giteration, 1, __ATOMIC_RELAXED);
     gcnt = cnt;
+    gset = 0;
+    gspent = 0;
+    ginjected = 0;
+    gslots = 0;
+    gslot = 0;
+    gsite = 0;
+    gdelayed_us = 0;
+    /** every iteration replays the same random sequence */
+    grand = ((uint64_t)gseed + cnt) * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+void toaster_set(int cnt) {
+    begin(cnt);
     gset = 1;
 }
 
+void toaster_injected(const char *site) {
+    if(!ginjected++) {
+        gsite = site;
+    }
+}
+
+const char *toaster_injected_site(void) {
+    return ginjected ? gsite : 0;
+}
+
 int toaster_get(void) {
     if(gset) {
         return gcnt;
@@ -49,6 +525,39 @@ int toaster_get(void) {
 void toaster_end(void) {
     gcnt = 0;
     gset = 0;
+    gspent = 0;
+    ginjected = 0;
+    gslots = 0;
+    gslot = 0;
+    gsite = 0;
+    gdelayed_us = 0;
+}
+
+void toaster_set_contexts(int on) {
+    gcontexts = on;
+}
+
+unsigned long toaster_context_iteration(void) {
+    return __atomic_load_n(&giteration, __ATOMIC_RELAXED);
+}
+
+unsigned long toaster_context_current(void) {
+    return tcontext;
+}
+
+unsigned long toaster_context_enter(unsigned long ctx) {
+    unsigned long prev = tcontext;
+    tcontext = ctx;
+    return prev;
+}
+
+int toaster_set_jobs(int jobs) {
+    int prev = gjobs;
+    if(jobs <= 0) {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    gjobs = jobs > 0 ? jobs : 1;
+    return prev;
 }
 
 int toaster_run(int (*test)(void)) {
@@ -59,14 +568,203 @@ int toaster_run_max(int max, int (*test)(void)) {
     return toaster_run_range(0, max, test);
 }
 
-int toaster_run_range(int min, int max, int (*test)(void)) {
-    int i;
+struct sweep {
+    int errnos;
+    void (*setup)(int);
+    int (*test)(void);
+    int (*test_ctx)(void *);
+    void *ctx;
+};
+
+static int sweep(int min, int max, int stride, const struct sweep *sw) {
+    int i, slot;
+    int err = -1;
+    for(i = min; i <= max; i += stride) {
+        slot = 0;
+        do {
+            TOASTER_LOG("test count: %d", i);
+            if(sw->errnos) {
+                TOASTER_LOG("errno slot: %d", slot);
+            }
+            if(sw->setup) {
+                begin(i);
+                sw->setup(i);
+            } else {
+                toaster_set(i);
+            }
+            gslot = slot;
+            err = sw->test ? sw->test() : sw->test_ctx(sw->ctx);
+            finish(i, err);
+        } while(sw->errnos && ++slot < gslots);
+        if(!err && !ginjected) {
+            break;
+        }
+    }
+    toaster_end();
+    return err;
+}
+
+/** libgcov, in tests built with -coverage that pull these in with -Wl,-u */
+extern void __gcov_dump(void) __attribute__((weak));
+extern void __gcov_reset(void) __attribute__((weak));
+
+/** seconds a crashing worker gets to dump before SIGALRM kills it */
+#define DUMP_TIMEOUT 2
+
+/**
+ * a crashing worker dumps its counters before it dies of the signal
+ * __gcov_dump allocates and locks files, which deadlocks if the worker crashed inside
+ * the allocator, so an alarm with the default action bounds it and the worker dies
+ * of SIGALRM without its counters instead of hanging sweep_jobs
+ */
+static void dump_coverage(int sig) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, 0);
+    alarm(DUMP_TIMEOUT);
+    __gcov_dump();
+    alarm(0);
+    raise(sig);
+}
+
+void toaster_coverage_worker(void) {
+    static const int fatal[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    /** room for the handler when the worker dies of a stack overflow */
+    static char altstack[1 << 16];
+    stack_t ss = {altstack, 0, sizeof(altstack)};
+    struct sigaction sa;
+    const char *base = getenv("GCOV_PREFIX");
+    char prefix[4096];
+    size_t i;
+    if(!__gcov_dump || !__gcov_reset) {
+        return;
+    }
+    __gcov_reset();
+    snprintf(prefix, sizeof(prefix), "%s%stoaster-worker.%d", base ? base : "",
+             base && *base ? "/" : "", (int)getpid());
+    setenv("GCOV_PREFIX", prefix, 1);
+    sigaltstack(&ss, 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_coverage;
+    sa.sa_flags = SA_ONSTACK | SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for(i = 0; i < sizeof(fatal) / sizeof(fatal[0]); ++i) {
+        sigaction(fatal[i], &sa, 0);
+    }
+}
+
+/**
+ * fork `jobs` workers, worker `w` runs counters min + w, min + w + jobs, ...
+ * each worker stops at its first passing iteration
+ */
+static int sweep_jobs(int min, int max, int jobs, const struct sweep *sw) {
+    int w, status;
+    int started = 0;
     int err = -1;
-    for(i = min; i <= max && err != 0; ++i) {
+    int crashed = 0;
+    pid_t pids[jobs];
+    fflush(NULL);
+    for(w = 0; w < jobs; ++w) {
+        pids[w] = fork();
+        if(pids[w] == 0) {
+            toaster_coverage_worker();
+            exit(sweep(min + w, max, jobs, sw) ? 1 : 0);
+        }
+        if(pids[w] < 0) {
+            TOASTER_LOG("fork failed: %d", errno);
+            crashed = 1;
+            break;
+        }
+        ++started;
+    }
+    for(w = 0; w < started; ++w) {
+        if(waitpid(pids[w], &status, 0) != pids[w]) {
+            crashed = 1;
+        } else if(WIFSIGNALED(status)) {
+            TOASTER_LOG("worker %d died: signal %d", w, WTERMSIG(status));
+            crashed = 1;
+        } else if(WEXITSTATUS(status) > 1) {
+            /** the sanitizers exit with their own codes, lsan with 23 for leaks */
+            TOASTER_LOG("worker %d died: exit %d", w, WEXITSTATUS(status));
+            crashed = 1;
+        } else if(!WEXITSTATUS(status)) {
+            err = 0;
+        }
+    }
+    return crashed ? -1 : err;
+}
+
+static int run(int min, int max, const struct sweep *sw) {
+    int jobs = gjobs;
+    if(jobs > max - min + 1) {
+        jobs = max - min + 1;
+    }
+    if(jobs <= 1) {
+        return sweep(min, max, 1, sw);
+    }
+    return sweep_jobs(min, max, jobs, sw);
+}
+
+int toaster_run_range(int min, int max, int (*test)(void)) {
+    struct sweep sw = {0, 0, test};
+    return run(min, max, &sw);
+}
+
+int toaster_run_errno_range(int min, int max, int (*test)(void)) {
+    struct sweep sw = {1, 0, test};
+    return run(min, max, &sw);
+}
+
+int toaster_run_with(int min, int max, void (*setup)(int i), int (*test)(void)) {
+    struct sweep sw = {0, setup, test};
+    return run(min, max, &sw);
+}
+
+int toaster_run_range_ctx(int min, int max, int (*test)(void *ctx), void *ctx) {
+    struct sweep sw = {0, 0, 0, test, ctx};
+    return run(min, max, &sw);
+}
+
+int toaster_run_errno_range_ctx(int min, int max, int (*test)(void *ctx), void *ctx) {
+    struct sweep sw = {1, 0, 0, test, ctx};
+    return run(min, max, &sw);
+}
+
+static long elapsed_us(int (*test)(void), int *err) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *err = test();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+int toaster_run_latency_range(int min, int max, int (*test)(void)) {
+    int i, err;
+    int amplifiers = 0;
+    long base, us;
+    double ratio;
+    enum toaster_action action = gaction;
+    base = elapsed_us(test, &err);
+    TOASTER_LOG("latency baseline: %ldus", base);
+    gaction = TOASTER_ACTION_DELAY;
+    for(i = min; i <= max && !err; ++i) {
         TOASTER_LOG("test count: %d", i);
         toaster_set(i);
-        err = test(); 
+        us = elapsed_us(test, &err);
+        if(!ginjected) {
+            break;
+        }
+        ratio = gdelayed_us ? (double)(us - base) / gdelayed_us : 0;
+        if(ratio >= TOASTER_AMPLIFICATION) {
+            ++amplifiers;
+        }
+        TOASTER_PRINTLN("toaster:latency:%s: delayed %ldus, end-to-end +%ldus, x%.1f%s",
+                        gsite ? gsite : "?", gdelayed_us, us - base, ratio,
+                        ratio >= TOASTER_AMPLIFICATION ? " amplified" : "");
     }
     toaster_end();
-    return err;
+    gaction = action;
+    return err ? -1 : amplifiers;
 }
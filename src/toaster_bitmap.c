@@ -0,0 +1,373 @@
+/**
+ * toaster_bitmap.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include "toaster.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86 1
+#endif
+
+/**
+ * bucketing, novelty and merge kernels for the edge map
+ * every kernel skips blocks that are all zero first, an iteration only hits a few
+ * hundred of the map's bytes, the scalar ones a word at a time like AFL
+ */
+
+/** hit counts to buckets, 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ */
+static const unsigned char gbuckets[256] = {
+    [0] = 0, [1] = 1, [2] = 2, [3] = 4,
+    [4 ... 7] = 8, [8 ... 15] = 16, [16 ... 31] = 32,
+    [32 ... 127] = 64, [128 ... 255] = 128,
+};
+
+struct kernel {
+    void (*classify)(unsigned char *map, size_t len);
+    int (*fresh)(const unsigned char *map, const unsigned char *seen, size_t len, int *edges);
+    void (*merge)(unsigned char *seen, const unsigned char *map, size_t len);
+};
+
+static uint64_t word(const unsigned char *p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static void classify_scalar(unsigned char *map, size_t len) {
+    size_t i = 0;
+    int j;
+    for(; i + 8 <= len; i += 8) {
+        if(word(map + i)) {
+            for(j = 0; j < 8; ++j) {
+                map[i + j] = gbuckets[map[i + j]];
+            }
+        }
+    }
+    for(; i < len; ++i) {
+        map[i] = gbuckets[map[i]];
+    }
+}
+
+static int fresh_bytes(const unsigned char *map, const unsigned char *seen, size_t len, int *edges) {
+    int cnt = 0;
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        if(map[i] & ~seen[i]) {
+            *edges += !seen[i];
+            ++cnt;
+        }
+    }
+    return cnt;
+}
+
+static int fresh_scalar(const unsigned char *map, const unsigned char *seen, size_t len, int *edges) {
+    int cnt = 0;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        if(word(map + i) & ~word(seen + i)) {
+            cnt += fresh_bytes(map + i, seen + i, 8, edges);
+        }
+    }
+    return cnt + fresh_bytes(map + i, seen + i, len - i, edges);
+}
+
+static void merge_scalar(unsigned char *seen, const unsigned char *map, size_t len) {
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t w = word(map + i);
+        if(w) {
+            w |= word(seen + i);
+            memcpy(seen + i, &w, sizeof(w));
+        }
+    }
+    for(; i < len; ++i) {
+        seen[i] |= map[i];
+    }
+}
+
+#ifdef X86
+/**
+ * sse2 compares bytes signed, v >= k unsigned is max(v, k) == v
+ * each step replaces the bytes at or above the bottom of a bucket with the bucket
+ */
+#define SSE2 __attribute__((target("sse2")))
+
+static SSE2 __m128i above128(__m128i r, __m128i v, int k, int b) {
+    __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8((char)k)), v);
+    return _mm_or_si128(_mm_andnot_si128(m, r), _mm_and_si128(m, _mm_set1_epi8((char)b)));
+}
+
+static SSE2 __m128i classify128(__m128i v) {
+    __m128i r = above128(v, v, 3, 4);
+    r = above128(r, v, 4, 8);
+    r = above128(r, v, 8, 16);
+    r = above128(r, v, 16, 32);
+    r = above128(r, v, 32, 64);
+    return above128(r, v, 128, 128);
+}
+
+static SSE2 unsigned nonzero128(__m128i v) {
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) & 0xffff;
+}
+
+/** blocks with more hit bytes than this take the six vector steps, fewer are looked up */
+#define SPARSE_BLOCK 8
+
+/**
+ * 64 bytes a step, 4 loads or'ed together and one test for the zero blocks
+ * the hit bytes of a sparse block are looked up in the table one at a time, which costs
+ * less than the vector steps and the branches to skip its zero lanes
+ */
+static SSE2 void classify_sse2(unsigned char *map, size_t len) {
+    size_t i = 0;
+    uint64_t hit, rest;
+    int j, k;
+    for(; i + 64 <= len; i += 64) {
+        __m128i *p = (__m128i *)(map + i);
+        __m128i v[4];
+        for(j = 0; j < 4; ++j) {
+            v[j] = _mm_loadu_si128(p + j);
+        }
+        if(!nonzero128(_mm_or_si128(_mm_or_si128(v[0], v[1]), _mm_or_si128(v[2], v[3])))) {
+            continue;
+        }
+        hit = 0;
+        for(j = 0; j < 4; ++j) {
+            hit |= (uint64_t)nonzero128(v[j]) << (16 * j);
+        }
+        rest = hit;
+        for(j = 0; j < SPARSE_BLOCK; ++j) {
+            rest &= rest - 1;
+        }
+        if(rest) {
+            for(j = 0; j < 4; ++j) {
+                _mm_storeu_si128(p + j, classify128(v[j]));
+            }
+            continue;
+        }
+        for(; hit; hit &= hit - 1) {
+            k = __builtin_ctzll(hit);
+            map[i + k] = gbuckets[map[i + k]];
+        }
+    }
+    classify_scalar(map + i, len - i);
+}
+
+static SSE2 int fresh_sse2(const unsigned char *map, const unsigned char *seen, size_t len, int *edges) {
+    int cnt = 0;
+    size_t i = 0;
+    int j;
+    for(; i + 64 <= len; i += 64) {
+        const __m128i *m = (const __m128i *)(map + i);
+        const __m128i *s = (const __m128i *)(seen + i);
+        __m128i v[4], o[4];
+        for(j = 0; j < 4; ++j) {
+            v[j] = _mm_loadu_si128(m + j);
+        }
+        if(!nonzero128(_mm_or_si128(_mm_or_si128(v[0], v[1]), _mm_or_si128(v[2], v[3])))) {
+            continue;
+        }
+        for(j = 0; j < 4; ++j) {
+            o[j] = _mm_loadu_si128(s + j);
+        }
+        if(!nonzero128(_mm_or_si128(_mm_or_si128(_mm_andnot_si128(o[0], v[0]), _mm_andnot_si128(o[1], v[1])),
+                                    _mm_or_si128(_mm_andnot_si128(o[2], v[2]), _mm_andnot_si128(o[3], v[3]))))) {
+            continue;
+        }
+        for(j = 0; j < 4; ++j) {
+            cnt += __builtin_popcount(nonzero128(_mm_andnot_si128(o[j], v[j])));
+            *edges += __builtin_popcount(nonzero128(v[j]) & ~nonzero128(o[j]));
+        }
+    }
+    return cnt + fresh_scalar(map + i, seen + i, len - i, edges);
+}
+
+static SSE2 void merge_sse2(unsigned char *seen, const unsigned char *map, size_t len) {
+    size_t i = 0;
+    int j;
+    for(; i + 64 <= len; i += 64) {
+        const __m128i *m = (const __m128i *)(map + i);
+        __m128i *s = (__m128i *)(seen + i);
+        __m128i v[4];
+        for(j = 0; j < 4; ++j) {
+            v[j] = _mm_loadu_si128(m + j);
+        }
+        if(!nonzero128(_mm_or_si128(_mm_or_si128(v[0], v[1]), _mm_or_si128(v[2], v[3])))) {
+            continue;
+        }
+        for(j = 0; j < 4; ++j) {
+            _mm_storeu_si128(s + j, _mm_or_si128(_mm_loadu_si128(s + j), v[j]));
+        }
+    }
+    merge_scalar(seen + i, map + i, len - i);
+}
+
+/**
+ * avx2 looks the buckets up by nibble, 32 byte vectors and 128 bytes a step
+ * counts under 16 bucket by the low nibble, the ones above by the high nibble into
+ * buckets of 32 and up, so the larger of the two lookups is the bucket
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 __m256i classify256(__m256i v) {
+    const __m256i low = _mm256_setr_epi8(0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16,
+                                         0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16);
+    const __m256i high = _mm256_setr_epi8(0, 32, 64, 64, 64, 64, 64, 64, (char)128, (char)128,
+                                          (char)128, (char)128, (char)128, (char)128, (char)128, (char)128,
+                                          0, 32, 64, 64, 64, 64, 64, 64, (char)128, (char)128,
+                                          (char)128, (char)128, (char)128, (char)128, (char)128, (char)128);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_shuffle_epi8(low, _mm256_and_si256(v, nibble));
+    __m256i hi = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    return _mm256_max_epu8(lo, hi);
+}
+
+static AVX2 unsigned nonzero256(__m256i v) {
+    return ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+
+static AVX2 int zero256(__m256i v) {
+    return _mm256_testz_si256(v, v);
+}
+
+static AVX2 void classify_avx2(unsigned char *map, size_t len) {
+    size_t i = 0;
+    int j;
+    for(; i + 128 <= len; i += 128) {
+        __m256i *p = (__m256i *)(map + i);
+        __m256i v[4];
+        for(j = 0; j < 4; ++j) {
+            v[j] = _mm256_loadu_si256(p + j);
+        }
+        if(zero256(_mm256_or_si256(_mm256_or_si256(v[0], v[1]), _mm256_or_si256(v[2], v[3])))) {
+            continue;
+        }
+        for(j = 0; j < 4; ++j) {
+            _mm256_storeu_si256(p + j, classify256(v[j]));
+        }
+    }
+    classify_scalar(map + i, len - i);
+}
+
+static AVX2 int fresh_avx2(const unsigned char *map, const unsigned char *seen, size_t len, int *edges) {
+    int cnt = 0;
+    size_t i = 0;
+    int j;
+    for(; i + 128 <= len; i += 128) {
+        const __m256i *m = (const __m256i *)(map + i);
+        const __m256i *s = (const __m256i *)(seen + i);
+        __m256i v[4], o[4];
+        for(j = 0; j < 4; ++j) {
+            v[j] = _mm256_loadu_si256(m + j);
+        }
+        if(zero256(_mm256_or_si256(_mm256_or_si256(v[0], v[1]), _mm256_or_si256(v[2], v[3])))) {
+            continue;
+        }
+        for(j = 0; j < 4; ++j) {
+            o[j] = _mm256_loadu_si256(s + j);
+        }
+        if(zero256(_mm256_or_si256(_mm256_or_si256(_mm256_andnot_si256(o[0], v[0]), _mm256_andnot_si256(o[1], v[1])),
+                                   _mm256_or_si256(_mm256_andnot_si256(o[2], v[2]), _mm256_andnot_si256(o[3], v[3]))))) {
+            continue;
+        }
+        for(j = 0; j < 4; ++j) {
+            cnt += __builtin_popcount(nonzero256(_mm256_andnot_si256(o[j], v[j])));
+            *edges += __builtin_popcount(nonzero256(v[j]) & ~nonzero256(o[j]));
+        }
+    }
+    return cnt + fresh_scalar(map + i, seen + i, len - i, edges);
+}
+
+static AVX2 void merge_avx2(unsigned char *seen, const unsigned char *map, size_t len) {
+    size_t i = 0;
+    int j;
+    for(; i + 128 <= len; i += 128) {
+        const __m256i *m = (const __m256i *)(map + i);
+        __m256i *s = (__m256i *)(seen + i);
+        __m256i v[4];
+        for(j = 0; j < 4; ++j) {
+            v[j] = _mm256_loadu_si256(m + j);
+        }
+        if(zero256(_mm256_or_si256(_mm256_or_si256(v[0], v[1]), _mm256_or_si256(v[2], v[3])))) {
+            continue;
+        }
+        for(j = 0; j < 4; ++j) {
+            _mm256_storeu_si256(s + j, _mm256_or_si256(_mm256_loadu_si256(s + j), v[j]));
+        }
+    }
+    merge_scalar(seen + i, map + i, len - i);
+}
+#endif
+
+static const struct kernel gkernels[] = {
+    [TOASTER_BITMAP_SCALAR] = {classify_scalar, fresh_scalar, merge_scalar},
+#ifdef X86
+    [TOASTER_BITMAP_SSE2] = {classify_sse2, fresh_sse2, merge_sse2},
+    [TOASTER_BITMAP_AVX2] = {classify_avx2, fresh_avx2, merge_avx2},
+#endif
+};
+static const struct kernel *gkernel = &gkernels[TOASTER_BITMAP_SCALAR];
+
+static int supported(int kernel) {
+#ifdef X86
+    switch(kernel) {
+    case TOASTER_BITMAP_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case TOASTER_BITMAP_SSE2:
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return kernel == TOASTER_BITMAP_SCALAR;
+}
+
+int toaster_bitmap_kernel(int kernel) {
+    kernel = kernel < TOASTER_BITMAP_SCALAR ? TOASTER_BITMAP_SCALAR
+           : kernel > TOASTER_BITMAP_AVX2 ? TOASTER_BITMAP_AVX2 : kernel;
+    while(kernel > TOASTER_BITMAP_SCALAR && !supported(kernel)) {
+        --kernel;
+    }
+    gkernel = &gkernels[kernel];
+    return kernel;
+}
+
+static void __attribute__((constructor)) init(void) {
+#ifdef X86
+    __builtin_cpu_init();
+#endif
+    toaster_bitmap_kernel(TOASTER_BITMAP_AVX2);
+}
+
+void toaster_bitmap_classify(unsigned char *map, size_t len) {
+    gkernel->classify(map, len);
+}
+
+int toaster_bitmap_new(const unsigned char *map, const unsigned char *seen, size_t len, int *edges) {
+    *edges = 0;
+    return gkernel->fresh(map, seen, len, edges);
+}
+
+void toaster_bitmap_merge(unsigned char *seen, const unsigned char *map, size_t len) {
+    gkernel->merge(seen, map, len);
+}
@@ -0,0 +1,216 @@
+/**
+ * toaster_budget.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "toaster.h"
+
+/**
+ * sweeps under a wall clock budget, linked in with toaster_edges.o
+ * a spread sample of the counters first, then the neighbours of the counters whose
+ * file has found the most new edges and failures per iteration
+ * a failure is an error without an injection, or an iteration a hook marked with toaster_fail
+ * neighbouring counters are neighbouring checks, mostly in the same function
+ */
+
+#define MAX_FILES 256
+/** a failure outweighs any number of new edges */
+#define FAILURE TOASTER_EDGE_MAP
+
+struct file {
+    const char *name;
+    int len;
+    int runs;
+    long long score;
+};
+
+struct slot {
+    int file;
+    int ran;
+};
+
+static struct file gfiles[MAX_FILES];
+static int gfiles_len;
+static struct toaster_budget greport;
+static int grunning;
+static const char *gsite;
+static int gleft;
+
+/** the budget is real time, even with virtual time from toaster_time.o */
+static long long now_ms(void) {
+    int (*real)(clockid_t, struct timespec *) = dlsym(RTLD_NEXT, "clock_gettime");
+    struct timespec ts;
+    real(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void done(int cnt, int err) {
+    if(grunning) {
+        gsite = toaster_injected_site();
+        gleft = toaster_get();
+    }
+}
+
+static void __attribute__((constructor)) init(void) {
+    toaster_on_done(done);
+}
+
+/** sites are file:line, or the call a mock is named after, which is its own file */
+static int file_of(const char *site) {
+    const char *colon;
+    int len, i;
+    if(!site) {
+        return -1;
+    }
+    colon = strchr(site, ':');
+    len = colon ? (int)(colon - site) : (int)strlen(site);
+    for(i = 0; i < gfiles_len; ++i) {
+        if(gfiles[i].len == len && !strncmp(gfiles[i].name, site, len)) {
+            return i;
+        }
+    }
+    if(gfiles_len == MAX_FILES) {
+        return -1;
+    }
+    gfiles[gfiles_len].name = site;
+    gfiles[gfiles_len].len = len;
+    gfiles[gfiles_len].runs = 0;
+    gfiles[gfiles_len].score = 0;
+    return gfiles_len++;
+}
+
+/** new edges and failures per iteration of the file, scaled so small yields still rank */
+static long long yield(const struct slot *s) {
+    const struct file *f;
+    if(!s || s->file < 0) {
+        return 0;
+    }
+    f = &gfiles[s->file];
+    return f->score * 1024 / f->runs;
+}
+
+/** @retval 1, if the iteration failed, which credits the file of its site */
+static int iterate(int cnt, int (*test)(void), struct slot *s) {
+    int failures = toaster_failures();
+    int err, failed;
+    gsite = 0;
+    err = toaster_run_range(cnt, cnt, test);
+    failed = (err && !gsite) || toaster_failures() > failures;
+    if(failed) {
+        TOASTER_LOG("budget: iteration %d failed, site %s", cnt, gsite ? gsite : "none");
+        ++greport.failures;
+    }
+    if(s) {
+        s->ran = 1;
+        s->file = file_of(gsite);
+        if(s->file >= 0) {
+            gfiles[s->file].runs += 1;
+            gfiles[s->file].score += toaster_edges_new() + (failed ? FAILURE : 0);
+        }
+    }
+    return failed;
+}
+
+/** the i-th of n counters in bit reversed order, spread over the range, -1 past the end */
+static int spread(int i, int n) {
+    int bits = 0, r = 0, b;
+    while((1 << bits) < n) {
+        ++bits;
+    }
+    for(b = 0; b < bits; ++b) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    return r < n ? r : -1;
+}
+
+/**
+ * the gap between counters that ran whose better end has the highest yield, and in it
+ * the counter next to that end, or the middle of the widest gap if nothing yielded
+ */
+static int next(const struct slot *slots, int n) {
+    long long best = -1;
+    int pick = -1, width = 0;
+    int lo = -1, i;
+    for(i = 0; i <= n; ++i) {
+        if(i < n && !slots[i].ran) {
+            continue;
+        }
+        if(i - lo > 1) {
+            long long left = yield(lo >= 0 ? &slots[lo] : 0);
+            long long right = yield(i < n ? &slots[i] : 0);
+            long long y = left > right ? left : right;
+            if(y > best || (y == best && !y && i - lo - 1 > width)) {
+                best = y;
+                width = i - lo - 1;
+                pick = !y ? lo + 1 + width / 2 : left >= right ? lo + 1 : i - 1;
+            }
+        }
+        lo = i;
+    }
+    return pick;
+}
+
+int toaster_budget_run_range(int min, int max, long long ms, int (*test)(void)) {
+    long long start = now_ms();
+    struct slot *slots;
+    int n, i, k = 0, cnt;
+    memset(&greport, 0, sizeof(greport));
+    gfiles_len = 0;
+    toaster_edges_clear();
+    grunning = 1;
+    /** a run with the counter out of reach counts the checks, INT_MAX would wrap the sweep */
+    iterate(INT_MAX - 1, test, 0);
+    n = INT_MAX - 1 - gleft;
+    n = (max < n - 1 ? max : n - 1) - min + 1;
+    n = n > 0 ? n : 0;
+    greport.counters = n;
+    slots = calloc(n ? n : 1, sizeof(*slots));
+    for(i = 0; slots && i < n && now_ms() - start < ms; ++i) {
+        if(i <= n / 8) {
+            cnt = -1;
+            while(cnt < 0) {
+                cnt = spread(k++, n);
+            }
+        } else {
+            cnt = next(slots, n);
+        }
+        iterate(min + cnt, test, &slots[cnt]);
+        ++greport.iterations;
+    }
+    grunning = 0;
+    free(slots);
+    greport.ms = now_ms() - start;
+    greport.edges = toaster_edges_total();
+    greport.complete = greport.iterations == n;
+    TOASTER_LOG("budget: %d of %d iterations in %lldms, %d edges, %d failures%s", greport.iterations,
+                n, greport.ms, greport.edges, greport.failures, greport.complete ? "" : ", out of time");
+    return greport.failures ? -1 : 0;
+}
+
+void toaster_budget_report(struct toaster_budget *report) {
+    *report = greport;
+}
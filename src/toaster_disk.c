@@ -0,0 +1,180 @@
+/**
+ * toaster_disk.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "toaster.h"
+
+static long long gbudget = -1;
+static long long gleft = -1;
+static long long gmin;
+static long long gstep;
+static int gerrno = ENOSPC;
+static int gdirty;
+
+static void reset(void) {
+    __atomic_store_n(&gleft, gbudget, __ATOMIC_RELAXED);
+    gdirty = 0;
+}
+
+static void __attribute__((constructor)) init(void) {
+    toaster_on_reset(reset);
+}
+
+void toaster_disk_budget(long long bytes) {
+    gbudget = bytes;
+    reset();
+}
+
+void toaster_disk_errno(int err) {
+    gerrno = err;
+}
+
+static int metered(int fd) {
+    struct stat st;
+    return __atomic_load_n(&gleft, __ATOMIC_RELAXED) >= 0 && !fstat(fd, &st) && S_ISREG(st.st_mode);
+}
+
+/**
+ * take up to `want` bytes from the budget
+ * @retval, bytes granted, 0 with errno set if the disk is full, a short grant leaves errno alone
+ */
+static size_t take(size_t want, const char *site) {
+    long long left = __atomic_load_n(&gleft, __ATOMIC_RELAXED);
+    long long got;
+    do {
+        got = (long long)want < left ? (long long)want : left;
+    } while(!__atomic_compare_exchange_n(&gleft, &left, left - got, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if(got < (long long)want) {
+        TOASTER_LOG("disk full: %s %lld of %zu bytes", site, got, want);
+        toaster_injected(site);
+        gdirty = 1;
+        if(!got) {
+            errno = gerrno;
+        }
+    }
+    return got;
+}
+
+/** give back what the real call did not write */
+static void refund(size_t granted, ssize_t written) {
+    if(written < (ssize_t)granted) {
+        __atomic_add_fetch(&gleft, granted - (written > 0 ? written : 0), __ATOMIC_RELAXED);
+    }
+}
+
+/** mock for write */
+ssize_t write(int fd, const void *buf, size_t count) {
+    ssize_t (*real)(int, const void *, size_t) = dlsym(RTLD_NEXT, "write");
+    size_t granted;
+    ssize_t rv;
+    if(!count || !metered(fd)) {
+        return real(fd, buf, count);
+    }
+    granted = take(count, "write");
+    if(!granted) {
+        return -1;
+    }
+    rv = real(fd, buf, granted);
+    refund(granted, rv);
+    return rv;
+}
+
+/** mock for pwrite */
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    ssize_t (*real)(int, const void *, size_t, off_t) = dlsym(RTLD_NEXT, "pwrite");
+    size_t granted;
+    ssize_t rv;
+    if(!count || !metered(fd)) {
+        return real(fd, buf, count, offset);
+    }
+    granted = take(count, "pwrite");
+    if(!granted) {
+        return -1;
+    }
+    rv = real(fd, buf, granted, offset);
+    refund(granted, rv);
+    return rv;
+}
+
+/** mock for fallocate, all or nothing */
+int fallocate(int fd, int mode, off_t offset, off_t len) {
+    int (*real)(int, int, off_t, off_t) = dlsym(RTLD_NEXT, "fallocate");
+    int rv;
+    long long left;
+    if((mode & FALLOC_FL_PUNCH_HOLE) || len <= 0 || !metered(fd)) {
+        return real(fd, mode, offset, len);
+    }
+    left = __atomic_load_n(&gleft, __ATOMIC_RELAXED);
+    do {
+        if(len > left) {
+            TOASTER_LOG("disk full: fallocate %lld bytes", (long long)len);
+            toaster_injected("fallocate");
+            errno = gerrno;
+            return -1;
+        }
+    } while(!__atomic_compare_exchange_n(&gleft, &left, left - len, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    rv = real(fd, mode, offset, len);
+    if(rv) {
+        __atomic_add_fetch(&gleft, len, __ATOMIC_RELAXED);
+    }
+    return rv;
+}
+
+/** mock for fsync, reports a full disk once for writes that ran out of budget since the last fsync */
+int fsync(int fd) {
+    int (*real)(int) = dlsym(RTLD_NEXT, "fsync");
+    if(gdirty && metered(fd)) {
+        gdirty = 0;
+        toaster_injected("fsync");
+        errno = gerrno;
+        return -1;
+    }
+    return real(fd);
+}
+
+static void setup(int i) {
+    toaster_disk_budget(gmin + gstep * i);
+}
+
+int toaster_disk_run_range(long long min, long long max, long long step, int (*test)(void)) {
+    int err;
+    gmin = min;
+    gstep = step > 0 ? step : 1;
+    /** the sweep counts steps in an int and stops short of INT_MAX */
+    if(min < 0 || max < min || (max - min) / gstep >= INT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    err = toaster_run_with(0, (int)((max - min) / gstep), setup, test);
+    toaster_disk_budget(-1);
+    return err;
+}
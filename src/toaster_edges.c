@@ -0,0 +1,150 @@
+/**
+ * toaster_edges.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "toaster.h"
+
+/**
+ * edge coverage from sanitizer coverage callbacks
+ * this layer is built without instrumentation, only the code under test has it
+ * an edge is the pair of the previous and the current block, hashed into the map
+ */
+
+#define MASK (TOASTER_EDGE_MAP - 1)
+
+/** hit counts of the current iteration */
+static unsigned char gmap[TOASTER_EDGE_MAP] __attribute__((aligned(64)));
+/** the sweep so far, in a shared mapping so the workers of a parallel sweep merge into it */
+struct sweep {
+    /** buckets every iteration of the sweep so far has hit */
+    unsigned char seen[TOASTER_EDGE_MAP] __attribute__((aligned(64)));
+    int total;
+    int stale;
+    pthread_mutex_t lock;
+};
+
+static struct sweep glocal = {.lock = PTHREAD_MUTEX_INITIALIZER};
+static struct sweep *gsweep = &glocal;
+static __thread uintptr_t tprev;
+static int gnew;
+
+/** gcc's -fsanitize-coverage=trace-pc calls this at the start of every block */
+void __sanitizer_cov_trace_pc(void) {
+    uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+    uintptr_t cur = (uintptr_t)((pc * 0x9E3779B97F4A7C15ULL) >> 48) & MASK;
+    ++gmap[cur ^ tprev];
+    tprev = cur >> 1;
+}
+
+/** clang's trace-pc-guard numbers every block once, 0 turns a guard off */
+void __sanitizer_cov_trace_pc_guard_init(uint32_t *start, uint32_t *stop) {
+    static uint32_t next;
+    if(start == stop || *start) {
+        return;
+    }
+    for(; start < stop; ++start) {
+        *start = 1 + (++next * 2654435761u) % MASK;
+    }
+}
+
+void __sanitizer_cov_trace_pc_guard(uint32_t *guard) {
+    uint32_t cur = *guard;
+    if(!cur) {
+        return;
+    }
+    ++gmap[(cur ^ tprev) & MASK];
+    tprev = cur >> 1;
+}
+
+static void reset(void) {
+    memset(gmap, 0, sizeof(gmap));
+    tprev = 0;
+}
+
+/** bucket the iteration's counts and merge them into the sweep's map */
+static void done(int cnt, int err) {
+    const char *site = toaster_injected_site();
+    int edges, total;
+    toaster_bitmap_classify(gmap, sizeof(gmap));
+    pthread_mutex_lock(&gsweep->lock);
+    gnew = toaster_bitmap_new(gmap, gsweep->seen, sizeof(gsweep->seen), &edges);
+    if(gnew) {
+        toaster_bitmap_merge(gsweep->seen, gmap, sizeof(gsweep->seen));
+        gsweep->total += edges;
+    } else {
+        ++gsweep->stale;
+    }
+    total = gsweep->total;
+    pthread_mutex_unlock(&gsweep->lock);
+    if(gnew) {
+        TOASTER_LOG("edges: iteration %d added %d, %d total, site %s", cnt, gnew, total,
+                    site ? site : "none");
+    } else {
+        TOASTER_LOG("edges: iteration %d hit no new edges, site %s", cnt, site ? site : "none");
+    }
+}
+
+static void __attribute__((constructor)) init(void) {
+    pthread_mutexattr_t attr;
+    struct sweep *shared = mmap(0, sizeof(*shared), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared != MAP_FAILED) {
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutex_init(&shared->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        gsweep = shared;
+    }
+    toaster_on_reset(reset);
+    toaster_on_done(done);
+}
+
+void toaster_edges_clear(void) {
+    pthread_mutex_lock(&gsweep->lock);
+    memset(gsweep->seen, 0, sizeof(gsweep->seen));
+    gsweep->total = 0;
+    gsweep->stale = 0;
+    pthread_mutex_unlock(&gsweep->lock);
+    reset();
+    gnew = 0;
+}
+
+const unsigned char *toaster_edges_map(void) {
+    return gmap;
+}
+
+int toaster_edges_new(void) {
+    return gnew;
+}
+
+int toaster_edges_total(void) {
+    return gsweep->total;
+}
+
+int toaster_edges_stale(void) {
+    return gsweep->stale;
+}
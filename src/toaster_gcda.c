@@ -0,0 +1,257 @@
+/**
+ * toaster_gcda.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "toaster.h"
+
+/**
+ * merges the .gcda files forked workers dumped into their own GCOV_PREFIX directories
+ * usage: toaster_gcda <prefix> <worker dir>...
+ * each file under a worker directory is summed into the file at the same path under
+ * `prefix`, in one pass over both, and the worker directory is removed
+ */
+
+#define GCDA_MAGIC 0x67636461u
+#define GCDA_HEADER 4
+/** byte record lengths and empty counter records came in with gcc 12 */
+#define GCDA_MIN_MAJOR 12
+#define TAG_FUNCTION 0x01000000u
+#define TAG_ARCS 0x01a10000u
+#define TAG_SUMMARY 0xa1000000u
+
+struct gcda {
+    uint32_t *words;
+    size_t len;
+};
+
+static const char *gprefix;
+static const char *gworker;
+static int gfailed;
+
+/**
+ * the gcc major version in the version word, "B22*" for 12.2, "A93*" for 9.3
+ * clang writes its own, like "408*", which is not a gcc version at all
+ */
+static int major(uint32_t version) {
+    int hi = (int)(version >> 24) & 0xff;
+    int lo = ((int)(version >> 16) & 0xff) - '0';
+    if(hi < 'A' || hi > 'Z' || lo < 0 || lo > 9) {
+        return 0;
+    }
+    return hi == 'A' ? lo : (hi - 'A') * 10 + lo;
+}
+
+static int load(const char *path, struct gcda *g) {
+    int err = 0;
+    FILE *f = 0;
+    long size;
+    g->words = 0;
+    g->len = 0;
+    TEST(err, f = fopen(path, "rb"));
+    TEST(err, !fseek(f, 0, SEEK_END));
+    TEST(err, (size = ftell(f)) >= (long)(GCDA_HEADER * sizeof(uint32_t)));
+    TEST(err, !fseek(f, 0, SEEK_SET));
+    TEST(err, g->words = malloc(size));
+    g->len = size / sizeof(uint32_t);
+    TEST(err, fread(g->words, sizeof(uint32_t), g->len, f) == g->len);
+    TEST(err, g->words[0] == GCDA_MAGIC);
+CHECK(err):
+    if(f) {
+        fclose(f);
+    }
+    return err;
+}
+
+/** written next to `path` and renamed over it, so a reader never sees half a file */
+static int save(const char *path, const uint32_t *words, size_t len) {
+    int err = 0;
+    char tmp[4096];
+    FILE *f = 0;
+    TEST(err, snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) < (int)sizeof(tmp));
+    TEST(err, f = fopen(tmp, "wb"));
+    TEST(err, fwrite(words, sizeof(uint32_t), len, f) == len);
+    TEST(err, !fclose(f));
+    f = 0;
+    TEST(err, !rename(tmp, path));
+CHECK(err):
+    if(f) {
+        fclose(f);
+        unlink(tmp);
+    }
+    return err;
+}
+
+static int mkdirs(char *path) {
+    char *slash;
+    for(slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = 0;
+        if(mkdir(path, 0755) && errno != EEXIST) {
+            *slash = '/';
+            return -1;
+        }
+        *slash = '/';
+    }
+    return 0;
+}
+
+/** a counter record of `len` bytes, negative when every counter is zero and none are stored */
+static uint64_t counter(const uint32_t *data, int32_t len, size_t i) {
+    if(len < 0) {
+        return 0;
+    }
+    return data[2 * i] | (uint64_t)data[2 * i + 1] << 32;
+}
+
+/**
+ * sums `src` into `dst`, both from the same build, records are walked side by side
+ * and have to line up, functions and their checksums are copied, summaries and arcs summed
+ * @retval the merged words in `out`, which has room for both files
+ */
+static int sum(const struct gcda *dst, const struct gcda *src, uint32_t *out, size_t *len) {
+    int err = 0;
+    size_t d = GCDA_HEADER, s = GCDA_HEADER, o = GCDA_HEADER;
+    memcpy(out, dst->words, GCDA_HEADER * sizeof(uint32_t));
+    while(d + 1 < dst->len && s + 1 < src->len && dst->words[d]) {
+        uint32_t tag = dst->words[d];
+        int32_t dlen = (int32_t)dst->words[d + 1];
+        int32_t slen = (int32_t)src->words[s + 1];
+        size_t dwords = dlen > 0 ? dlen / sizeof(uint32_t) : 0;
+        size_t swords = slen > 0 ? slen / sizeof(uint32_t) : 0;
+        TEST(err, tag == src->words[s]);
+        TEST(err, d + 2 + dwords <= dst->len && s + 2 + swords <= src->len);
+        out[o] = tag;
+        if(tag == TAG_ARCS) {
+            size_t n = (size_t)(dlen < 0 ? -dlen : dlen) / sizeof(uint64_t);
+            size_t i;
+            uint64_t any = 0;
+            TEST(err, n == (size_t)(slen < 0 ? -slen : slen) / sizeof(uint64_t));
+            for(i = 0; i < n; ++i) {
+                uint64_t c = counter(&dst->words[d + 2], dlen, i) + counter(&src->words[s + 2], slen, i);
+                out[o + 2 + 2 * i] = (uint32_t)c;
+                out[o + 3 + 2 * i] = (uint32_t)(c >> 32);
+                any |= c;
+            }
+            out[o + 1] = (uint32_t)(any ? (int32_t)(n * sizeof(uint64_t)) : -(int32_t)(n * sizeof(uint64_t)));
+            o += 2 + (any ? 2 * n : 0);
+        } else if(tag == TAG_SUMMARY) {
+            TEST(err, dwords == 2 && swords == 2);
+            out[o + 1] = dst->words[d + 1];
+            out[o + 2] = dst->words[d + 2] + src->words[s + 2];
+            out[o + 3] = dst->words[d + 3] + src->words[s + 3];
+            o += 4;
+        } else {
+            /** function records, and counters -coverage does not write, have to be identical */
+            TEST(err, dlen == slen && !memcmp(&dst->words[d + 2], &src->words[s + 2], dwords * sizeof(uint32_t)));
+            memcpy(&out[o + 1], &dst->words[d + 1], (1 + dwords) * sizeof(uint32_t));
+            o += 2 + dwords;
+        }
+        d += 2 + dwords;
+        s += 2 + swords;
+    }
+    out[o++] = 0;
+    *len = o;
+CHECK(err):
+    return err;
+}
+
+/** a build with a different stamp replaces the old counts, like libgcov does */
+static int merge(const char *path, const struct gcda *src) {
+    int err = 0;
+    struct gcda dst = {0, 0};
+    uint32_t *out = 0;
+    size_t len;
+    if(access(path, F_OK) || load(path, &dst) || memcmp(dst.words, src->words, GCDA_HEADER * sizeof(uint32_t))) {
+        err = save(path, src->words, src->len);
+        goto CHECK(err);
+    }
+    TEST(err, out = malloc((dst.len + src->len + 1) * sizeof(uint32_t)));
+    TEST(err, !sum(&dst, src, out, &len));
+    TEST(err, !save(path, out, len));
+CHECK(err):
+    free(out);
+    free(dst.words);
+    return err;
+}
+
+static int visit(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    int err = 0;
+    struct gcda src = {0, 0};
+    char dst[4096];
+    const char *rel = path + strlen(gworker);
+    size_t n = strlen(path);
+    if(type == FTW_DP) {
+        rmdir(path);
+        return 0;
+    }
+    if(type != FTW_F || n < 5 || strcmp(path + n - 5, ".gcda")) {
+        return 0;
+    }
+    while(*rel == '/') {
+        ++rel;
+    }
+    TEST(err, snprintf(dst, sizeof(dst), "%s/%s", gprefix, rel) < (int)sizeof(dst));
+    TEST(err, !mkdirs(dst));
+    TEST(err, !load(path, &src));
+    if(major(src.words[1]) < GCDA_MIN_MAJOR) {
+        uint32_t v = src.words[1];
+        fprintf(stderr, "toaster_gcda: %s has gcov version %c%c%c%c, merging needs the format of gcc %d or later\n",
+                path, (int)(v >> 24) & 0xff, (int)(v >> 16) & 0xff, (int)(v >> 8) & 0xff, (int)v & 0xff,
+                GCDA_MIN_MAJOR);
+    }
+    TEST(err, major(src.words[1]) >= GCDA_MIN_MAJOR);
+    TEST(err, !merge(dst, &src));
+    unlink(path);
+CHECK(err):
+    if(err) {
+        fprintf(stderr, "toaster_gcda: could not merge %s into %s\n", path, dst);
+        gfailed = 1;
+    }
+    free(src.words);
+    return 0;
+}
+
+int main(int argc, char * const argv[]) {
+    int i;
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <prefix> <worker dir>...\n", argv[0]);
+        return 2;
+    }
+    gprefix = strcmp(argv[1], "/") ? argv[1] : "";
+    for(i = 2; i < argc; ++i) {
+        struct stat st;
+        /** an unmatched glob is passed through by the shell */
+        if(stat(argv[i], &st) || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        gworker = argv[i];
+        nftw(argv[i], visit, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    return gfailed;
+}
@@ -0,0 +1,187 @@
+/**
+ * toaster_iov.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "toaster.h"
+
+/**
+ * truncation points are every `gstep` bytes into each iovec and every iovec boundary
+ * each point is a toaster_check_once site, so counter `i` cuts the first vectored call
+ * of the iteration at its `i`th point, or a later call once the earlier ones ran out
+ */
+static size_t gstep;
+
+void toaster_iov_faults(size_t step) {
+    gstep = step;
+}
+
+static size_t total(const struct iovec *iov, int iovcnt) {
+    size_t sum = 0;
+    int i;
+    for(i = 0; i < iovcnt; ++i) {
+        sum += iov[i].iov_len;
+    }
+    return sum;
+}
+
+/**
+ * pick the length to cut the vector to
+ * @retval 1, if the vector was cut to `len` bytes
+ */
+static int cut(const struct iovec *iov, int iovcnt, const char *site, const void *caller,
+               size_t *len) {
+    size_t all = total(iov, iovcnt);
+    size_t off = 0, at;
+    int i;
+    for(i = 0; gstep && i < iovcnt; ++i) {
+        for(at = gstep; at < iov[i].iov_len; at += gstep) {
+            if(toaster_check_once_from(site, caller)) {
+                TOASTER_LOG("%s: cut at %zu, %zu into iovec %d", site, off + at, at, i);
+                *len = off + at;
+                return 1;
+            }
+        }
+        off += iov[i].iov_len;
+        if(iov[i].iov_len && off < all && toaster_check_once_from(site, caller)) {
+            TOASTER_LOG("%s: cut at %zu, end of iovec %d", site, off, i);
+            *len = off;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * copy the first `len` bytes of the vector into `out`
+ * @retval, the number of iovecs in `out`
+ */
+static int shorten(const struct iovec *iov, int iovcnt, size_t len, struct iovec *out) {
+    int i;
+    for(i = 0; i < iovcnt && len; ++i) {
+        out[i] = iov[i];
+        if(out[i].iov_len > len) {
+            out[i].iov_len = len;
+        }
+        len -= out[i].iov_len;
+    }
+    return i;
+}
+
+/** room for the shortened copy, counts the kernel rejects with EINVAL pass through */
+#define VALID(iovcnt) ((iovcnt) > 0 && (iovcnt) <= IOV_MAX)
+#define VLEN(iovcnt) (VALID(iovcnt) ? (iovcnt) : 1)
+
+static int stream(int fd) {
+    int type = 0;
+    socklen_t len = sizeof(type);
+    return !getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) && type == SOCK_STREAM;
+}
+
+/** datagram and seqpacket sockets move whole messages, files and pipes can go short */
+static int message(int fd) {
+    int type = 0;
+    socklen_t len = sizeof(type);
+    return !getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) && type != SOCK_STREAM;
+}
+
+/** mock for writev, messages on datagram sockets are never cut */
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t (*real)(int, const struct iovec *, int) = dlsym(RTLD_NEXT, "writev");
+    struct iovec out[VLEN(iovcnt)];
+    size_t len;
+    if(!gstep || !VALID(iovcnt) || message(fd)) {
+        return real(fd, iov, iovcnt);
+    }
+    if(!cut(iov, iovcnt, "writev", TOASTER_CALLER, &len)) {
+        return real(fd, iov, iovcnt);
+    }
+    return real(fd, out, shorten(iov, iovcnt, len, out));
+}
+
+/** mock for readv, messages on datagram sockets are never cut */
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t (*real)(int, const struct iovec *, int) = dlsym(RTLD_NEXT, "readv");
+    struct iovec out[VLEN(iovcnt)];
+    size_t len;
+    if(!gstep || !VALID(iovcnt) || message(fd)) {
+        return real(fd, iov, iovcnt);
+    }
+    if(!cut(iov, iovcnt, "readv", TOASTER_CALLER, &len)) {
+        return real(fd, iov, iovcnt);
+    }
+    return real(fd, out, shorten(iov, iovcnt, len, out));
+}
+
+/** mock for sendmsg, only stream sockets send short, datagrams are sent whole */
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    ssize_t (*real)(int, const struct msghdr *, int) = dlsym(RTLD_NEXT, "sendmsg");
+    int iovcnt = msg->msg_iovlen <= IOV_MAX ? (int)msg->msg_iovlen : -1;
+    struct iovec out[VLEN(iovcnt)];
+    struct msghdr m = *msg;
+    size_t len;
+    if(!gstep || !VALID(iovcnt) || !stream(fd)) {
+        return real(fd, msg, flags);
+    }
+    if(!cut(msg->msg_iov, iovcnt, "sendmsg", TOASTER_CALLER, &len)) {
+        return real(fd, msg, flags);
+    }
+    m.msg_iov = out;
+    m.msg_iovlen = shorten(msg->msg_iov, iovcnt, len, out);
+    return real(fd, &m, flags);
+}
+
+/**
+ * mock for recvmsg, the kernel sees the shorter buffers
+ * a datagram that does not fit comes back with MSG_TRUNC, and control data that
+ * does not fit with MSG_CTRUNC, with any passed fds closed by the kernel
+ */
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) {
+    ssize_t (*real)(int, struct msghdr *, int) = dlsym(RTLD_NEXT, "recvmsg");
+    int iovcnt = msg->msg_iovlen <= IOV_MAX ? (int)msg->msg_iovlen : -1;
+    struct iovec out[VLEN(iovcnt)];
+    struct iovec *iov = msg->msg_iov;
+    size_t iovlen = msg->msg_iovlen;
+    size_t controllen = msg->msg_controllen;
+    size_t len;
+    ssize_t rv;
+    if(cut(iov, iovcnt, "recvmsg", TOASTER_CALLER, &len)) {
+        msg->msg_iov = out;
+        msg->msg_iovlen = shorten(iov, iovcnt, len, out);
+    }
+    if(gstep && controllen && toaster_check_once_from("recvmsg:ctrunc", TOASTER_CALLER)) {
+        TOASTER_LOG("recvmsg: control cut at 0 of %zu", controllen);
+        msg->msg_controllen = 0;
+    }
+    rv = real(fd, msg, flags);
+    msg->msg_iov = iov;
+    msg->msg_iovlen = iovlen;
+    if(rv < 0) {
+        msg->msg_controllen = controllen;
+    }
+    return rv;
+}
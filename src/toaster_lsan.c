@@ -0,0 +1,206 @@
+/**
+ * toaster_lsan.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "toaster.h"
+
+/**
+ * per-iteration leak checks for tests built with -fsanitize=address
+ * lsan reports every leak it finds on every check, so the report goes to a memfd and
+ * only an iteration that grows the summary is new, its report is copied to stderr
+ * without asan linked in the sanitizer calls are null and the layer does nothing
+ */
+
+extern int __lsan_do_recoverable_leak_check(void) __attribute__((weak));
+extern void __sanitizer_set_report_fd(void *fd) __attribute__((weak));
+
+#define SITE_LEN 256
+
+/** what leaked so far, in a shared mapping so the workers of a parallel sweep count in it */
+struct leaks {
+    int leaks;
+    long long bytes;
+    char site[SITE_LEN];
+};
+
+static struct leaks glocal;
+static struct leaks *gleaks = &glocal;
+static int gfd = -1;
+static pid_t gpid;
+static pid_t gmain;
+/** what had leaked before the iteration */
+static long long gbase;
+/** set at exit in a forked worker, whose leaks were counted in the shared mapping */
+static int gquiet;
+
+/**
+ * defaults the environment overrides, the fast frame pointer unwinder with short
+ * allocation stacks keeps every check cheap, errors abort so a worker dies of them
+ */
+const char *__asan_default_options(void) {
+    return "abort_on_error=1:detect_leaks=1:fast_unwind_on_malloc=1:malloc_context_size=8";
+}
+
+const char *__lsan_default_options(void) {
+    return "fast_unwind_on_malloc=1:malloc_context_size=8:report_objects=0";
+}
+
+/** leaks that are not the test's, LSAN_OPTIONS=suppressions=<file> adds to them */
+const char *__lsan_default_suppressions(void) {
+    return "leak:_dlerror_run\n"
+           "leak:_dl_map_object\n";
+}
+
+/** the summary at the end of the report, 0 if there is none */
+static long long summary(void) {
+    char buf[4096];
+    struct stat st;
+    long long bytes = 0;
+    off_t off;
+    ssize_t len;
+    const char *s;
+    if(fstat(gfd, &st)) {
+        return 0;
+    }
+    off = st.st_size > (off_t)sizeof(buf) - 1 ? st.st_size - (off_t)sizeof(buf) + 1 : 0;
+    len = pread(gfd, buf, sizeof(buf) - 1, off);
+    buf[len > 0 ? len : 0] = 0;
+    s = strstr(buf, "SUMMARY:");
+    if(s && (s = strchr(s + 8, ':'))) {
+        sscanf(s + 1, "%lld", &bytes);
+    }
+    return bytes;
+}
+
+static void report(void) {
+    char buf[4096];
+    ssize_t len;
+    off_t off = 0;
+    while((len = pread(gfd, buf, sizeof(buf), off)) > 0) {
+        off += len;
+        if(write(2, buf, len) != len) {
+            return;
+        }
+    }
+}
+
+/**
+ * the checks scan the stack below the runner, where the iteration's dead frames still
+ * hold pointers to what it leaked, clear them first
+ */
+static void __attribute__((noinline)) scrub(void) {
+    char stack[1 << 16];
+    memset(stack, 0, sizeof(stack));
+    __asm__ volatile("" : : "r"(stack) : "memory");
+}
+
+/** the bytes lsan finds leaked, with its report in the memfd */
+static long long check(void) {
+    long long bytes = 0;
+    /** lsan writes at the fd's offset, which truncating leaves where the last report ended */
+    if(gfd < 0 || ftruncate(gfd, 0) || lseek(gfd, 0, SEEK_SET)) {
+        return 0;
+    }
+    scrub();
+    __sanitizer_set_report_fd((void *)(long)gfd);
+    if(__lsan_do_recoverable_leak_check()) {
+        bytes = summary();
+    }
+    __sanitizer_set_report_fd((void *)2L);
+    return bytes;
+}
+
+/** lsan skips its check at exit when this returns 1 */
+int __lsan_is_turned_off(void) {
+    return gquiet;
+}
+
+static void quiet(void) {
+    gquiet = 1;
+}
+
+/**
+ * every iteration takes what already leaked as its baseline, so leaks freed since the
+ * last one do not hide new ones, forked workers share the parent's memfd and open their
+ * own, and skip lsan's exit check, which runs after atexit handlers registered later
+ */
+static void reset(void) {
+    if(gpid != getpid()) {
+        if(gfd >= 0) {
+            close(gfd);
+        }
+        gfd = memfd_create("toaster_lsan", MFD_CLOEXEC);
+        gpid = getpid();
+        if(gpid != gmain) {
+            atexit(quiet);
+        }
+    }
+    gbase = check();
+}
+
+static void done(int cnt, int err) {
+    const char *site = toaster_injected_site();
+    long long bytes = check();
+    if(bytes > gbase) {
+        report();
+        TOASTER_LOG("lsan: iteration %d leaked %lld bytes, site %s", cnt, bytes - gbase,
+                    site ? site : "none");
+        if(!__atomic_fetch_add(&gleaks->leaks, 1, __ATOMIC_RELAXED)) {
+            snprintf(gleaks->site, sizeof(gleaks->site), "%s", site ? site : "none");
+        }
+        __atomic_add_fetch(&gleaks->bytes, bytes - gbase, __ATOMIC_RELAXED);
+        toaster_fail("leak");
+    }
+}
+
+static void __attribute__((constructor)) init(void) {
+    struct leaks *shared;
+    gmain = getpid();
+    if(__lsan_do_recoverable_leak_check && __sanitizer_set_report_fd) {
+        shared = mmap(0, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                      -1, 0);
+        if(shared != MAP_FAILED) {
+            gleaks = shared;
+        }
+        toaster_on_reset(reset);
+        toaster_on_done(done);
+    }
+}
+
+int toaster_lsan_leaks(void) {
+    return __atomic_load_n(&gleaks->leaks, __ATOMIC_RELAXED);
+}
+
+long long toaster_lsan_bytes(void) {
+    return __atomic_load_n(&gleaks->bytes, __ATOMIC_RELAXED);
+}
+
+const char *toaster_lsan_site(void) {
+    return toaster_lsan_leaks() ? gleaks->site : 0;
+}
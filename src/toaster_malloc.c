@@ -0,0 +1,146 @@
+/**
+ * toaster_malloc.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "toaster.h"
+
+/**
+ * glibc's own entry points, which unlike dlsym never allocate, so the mocks
+ * can be called while the loader is still resolving symbols
+ */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void __libc_free(void *p);
+
+static int gfaults;
+static long long glive;
+
+void toaster_malloc_faults(int on) {
+    gfaults = on;
+}
+
+long long toaster_heap_live(void) {
+    return __atomic_load_n(&glive, __ATOMIC_RELAXED);
+}
+
+/** never throws, an exception cannot unwind through the C frames that called malloc */
+static int check(const char *site, const void *caller) {
+    if(gfaults && toaster_check_nothrow_from(site, caller)) {
+        TOASTER_LOG("mock failure: %s", site);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+static void *track(void *p) {
+    if(p) {
+        __atomic_add_fetch(&glive, (long long)malloc_usable_size(p), __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+static void untrack(void *p) {
+    if(p) {
+        __atomic_sub_fetch(&glive, (long long)malloc_usable_size(p), __ATOMIC_RELAXED);
+    }
+}
+
+/** mock for malloc */
+void *malloc(size_t size) {
+    if(check("malloc", TOASTER_CALLER)) {
+        return 0;
+    }
+    return track(__libc_malloc(size));
+}
+
+/** mock for calloc */
+void *calloc(size_t n, size_t size) {
+    if(check("calloc", TOASTER_CALLER)) {
+        return 0;
+    }
+    return track(__libc_calloc(n, size));
+}
+
+/** mock for realloc, a failed realloc leaves the old block alone */
+void *realloc(void *p, size_t size) {
+    void *rv;
+    size_t old = p ? malloc_usable_size(p) : 0;
+    if(size && check("realloc", TOASTER_CALLER)) {
+        return 0;
+    }
+    rv = __libc_realloc(p, size);
+    if(rv || !size) {
+        __atomic_sub_fetch(&glive, (long long)old, __ATOMIC_RELAXED);
+        track(rv);
+    }
+    return rv;
+}
+
+/** mock for free */
+void free(void *p) {
+    untrack(p);
+    __libc_free(p);
+}
+
+/** mock for memalign, what aligned operator new and the other aligned calls end up in */
+void *memalign(size_t align, size_t size) {
+    if(check("memalign", TOASTER_CALLER)) {
+        return 0;
+    }
+    return track(__libc_memalign(align, size));
+}
+
+/** mock for aligned_alloc */
+void *aligned_alloc(size_t align, size_t size) {
+    if(check("aligned_alloc", TOASTER_CALLER)) {
+        return 0;
+    }
+    return track(__libc_memalign(align, size));
+}
+
+/** mock for posix_memalign */
+int posix_memalign(void **p, size_t align, size_t size) {
+    if(!align || (align & (align - 1)) || align % sizeof(void *)) {
+        return EINVAL;
+    }
+    if(check("posix_memalign", TOASTER_CALLER)) {
+        return ENOMEM;
+    }
+    *p = track(__libc_memalign(align, size));
+    return *p ? 0 : ENOMEM;
+}
+
+/** mock for valloc */
+void *valloc(size_t size) {
+    if(check("valloc", TOASTER_CALLER)) {
+        return 0;
+    }
+    return track(__libc_memalign(sysconf(_SC_PAGESIZE), size));
+}
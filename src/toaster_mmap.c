@@ -0,0 +1,108 @@
+/**
+ * toaster_mmap.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include "toaster.h"
+
+static int gfaults;
+
+static const int mmap_errnos[] = {ENOMEM, EAGAIN, EACCES, ENODEV, EINVAL, EPERM};
+static const int mmap_hugetlb_errnos[] = {ENOMEM, EINVAL, EPERM};
+static const int mmap_populate_errnos[] = {ENOMEM, EAGAIN};
+static const int munmap_errnos[] = {EINVAL, ENOMEM};
+static const int mremap_errnos[] = {ENOMEM, EAGAIN, EFAULT, EINVAL};
+static const int madvise_errnos[] = {EAGAIN, ENOMEM, EINVAL};
+
+void toaster_mmap_faults(int on) {
+    gfaults = on;
+}
+
+static int check(const char *site, const void *caller) {
+    if(gfaults && toaster_check_from(site, caller)) {
+        TOASTER_LOG("mock failure: %s", site);
+        return -1;
+    }
+    return 0;
+}
+
+/** mock for mmap, huge page and populated mappings fail at their own sites */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+    void *(*real)(void *, size_t, int, int, int, off_t) = dlsym(RTLD_NEXT, "mmap");
+    if((flags & MAP_HUGETLB) && check("mmap:hugetlb", TOASTER_CALLER)) {
+        TOASTER_ERRNO(mmap_hugetlb_errnos);
+        return MAP_FAILED;
+    }
+    if((flags & MAP_POPULATE) && check("mmap:populate", TOASTER_CALLER)) {
+        TOASTER_ERRNO(mmap_populate_errnos);
+        return MAP_FAILED;
+    }
+    if(check("mmap", TOASTER_CALLER)) {
+        TOASTER_ERRNO(mmap_errnos);
+        return MAP_FAILED;
+    }
+    return real(addr, len, prot, flags, fd, off);
+}
+
+/** mock for munmap, a failed unmap leaves the mapping in place */
+int munmap(void *addr, size_t len) {
+    int (*real)(void *, size_t) = dlsym(RTLD_NEXT, "munmap");
+    if(check("munmap", TOASTER_CALLER)) {
+        TOASTER_ERRNO(munmap_errnos);
+        return -1;
+    }
+    return real(addr, len);
+}
+
+/** mock for mremap, a mapping that may move can be refused the move */
+void *mremap(void *old, size_t old_len, size_t new_len, int flags, ...) {
+    void *(*real)(void *, size_t, size_t, int, ...) = dlsym(RTLD_NEXT, "mremap");
+    void *new = 0;
+    va_list ap;
+    if(flags & MREMAP_FIXED) {
+        va_start(ap, flags);
+        new = va_arg(ap, void *);
+        va_end(ap);
+    }
+    if(check("mremap", TOASTER_CALLER)) {
+        TOASTER_ERRNO(mremap_errnos);
+        return MAP_FAILED;
+    }
+    if((flags & MREMAP_MAYMOVE) && !(flags & MREMAP_FIXED) && check("mremap:move", TOASTER_CALLER)) {
+        flags &= ~MREMAP_MAYMOVE;
+    }
+    return real(old, old_len, new_len, flags, new);
+}
+
+/** mock for madvise */
+int madvise(void *addr, size_t len, int advice) {
+    int (*real)(void *, size_t, int) = dlsym(RTLD_NEXT, "madvise");
+    if(check("madvise", TOASTER_CALLER)) {
+        TOASTER_ERRNO(madvise_errnos);
+        return -1;
+    }
+    return real(addr, len, advice);
+}
@@ -0,0 +1,435 @@
+/**
+ * toaster_net.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <errno.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include "toaster.h"
+
+#define QUEUE 64
+#define PATH sizeof(((struct sockaddr_un *)0)->sun_path)
+
+/**
+ * a unix address, a pathname ends at its first NUL or fills sun_path,
+ * an abstract name starts with a NUL and every byte up to addrlen counts
+ */
+struct addr {
+    size_t len;
+    char path[PATH];
+};
+
+struct dgram {
+    size_t len;
+    struct addr from;
+    char data[];
+};
+
+/** bounded lock-free queue, Vyukov */
+struct cell {
+    size_t seq;
+    struct dgram *dgram;
+};
+
+struct queue {
+    struct cell cells[QUEUE];
+    size_t head;
+    size_t tail;
+};
+
+struct sock {
+    int used;
+    int bound;
+    int nonblock;
+    struct addr addr;
+    struct queue queue;
+    struct dgram *held;
+};
+
+static int gfake;
+static unsigned gfaults;
+static struct sock gsocks[TOASTER_NET_MAX_SOCKETS];
+
+static const int socket_errnos[] = {
+    EMFILE, ENFILE, ENOBUFS, ENOMEM, EACCES, EAFNOSUPPORT, EINVAL, EPROTONOSUPPORT,
+};
+
+static const int bind_errnos[] = {
+    EADDRINUSE, EACCES, EADDRNOTAVAIL, EBADF, EINVAL, ENOTSOCK,
+    ELOOP, ENAMETOOLONG, ENOENT, ENOMEM, ENOTDIR, EROFS,
+};
+
+static const int sendto_errnos[] = {
+    EAGAIN, ENOBUFS, EINTR, ECONNREFUSED, ENOENT, EMSGSIZE, ENOMEM, EPIPE, EBADF,
+};
+
+static const int recvfrom_errnos[] = {
+    EAGAIN, EINTR, ECONNREFUSED, ENOMEM, EBADF, EINVAL,
+};
+
+static void queue_init(struct queue *q) {
+    size_t i;
+    for(i = 0; i < QUEUE; ++i) {
+        q->cells[i].seq = i;
+    }
+    q->head = 0;
+    q->tail = 0;
+}
+
+static int queue_push(struct queue *q, struct dgram *d) {
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    struct cell *c;
+    long dif;
+    for(;;) {
+        c = &q->cells[pos % QUEUE];
+        dif = (long)__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (long)pos;
+        if(dif == 0 && __atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        } else if(dif < 0) {
+            return -1;
+        } else if(dif > 0) {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+    c->dgram = d;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static struct dgram *queue_pop(struct queue *q) {
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    struct cell *c;
+    struct dgram *d;
+    long dif;
+    for(;;) {
+        c = &q->cells[pos % QUEUE];
+        dif = (long)__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (long)(pos + 1);
+        if(dif == 0 && __atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        } else if(dif < 0) {
+            return 0;
+        } else if(dif > 0) {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+    d = c->dgram;
+    __atomic_store_n(&c->seq, pos + QUEUE, __ATOMIC_RELEASE);
+    return d;
+}
+
+static struct sock *fake(int fd) {
+    struct sock *s;
+    if(fd < TOASTER_NET_FD_BASE || fd >= TOASTER_NET_FD_BASE + TOASTER_NET_MAX_SOCKETS) {
+        return 0;
+    }
+    s = &gsocks[fd - TOASTER_NET_FD_BASE];
+    return __atomic_load_n(&s->used, __ATOMIC_ACQUIRE) ? s : 0;
+}
+
+static struct sock *endpoint(const struct addr *a) {
+    int i;
+    for(i = 0; i < TOASTER_NET_MAX_SOCKETS; ++i) {
+        if(__atomic_load_n(&gsocks[i].bound, __ATOMIC_ACQUIRE) &&
+           gsocks[i].addr.len == a->len && !memcmp(gsocks[i].addr.path, a->path, a->len)) {
+            return &gsocks[i];
+        }
+    }
+    return 0;
+}
+
+static int sun_path(const struct sockaddr *addr, socklen_t addrlen, struct addr *a) {
+    const struct sockaddr_un *un = (const struct sockaddr_un *)addr;
+    size_t len;
+    if(!addr || addrlen <= offsetof(struct sockaddr_un, sun_path) ||
+       addrlen > sizeof(struct sockaddr_un) || un->sun_family != AF_UNIX) {
+        return -1;
+    }
+    len = addrlen - offsetof(struct sockaddr_un, sun_path);
+    if(un->sun_path[0]) {
+        len = strnlen(un->sun_path, len);
+    }
+    a->len = len;
+    memcpy(a->path, un->sun_path, len);
+    return 0;
+}
+
+static void release(struct sock *s) {
+    struct dgram *d;
+    __atomic_store_n(&s->bound, 0, __ATOMIC_RELEASE);
+    while((d = queue_pop(&s->queue))) {
+        free(d);
+    }
+    free(__atomic_exchange_n(&s->held, 0, __ATOMIC_ACQ_REL));
+    __atomic_store_n(&s->used, 0, __ATOMIC_RELEASE);
+}
+
+static void reset(void) {
+    int i;
+    for(i = 0; i < TOASTER_NET_MAX_SOCKETS; ++i) {
+        if(gsocks[i].used) {
+            TOASTER_LOG("net: leaked fake socket %d", TOASTER_NET_FD_BASE + i);
+            release(&gsocks[i]);
+        }
+    }
+}
+
+static void __attribute__((constructor)) init(void) {
+    toaster_on_reset(reset);
+}
+
+void toaster_net_fake(int on) {
+    reset();
+    gfake = on;
+}
+
+void toaster_net_faults(unsigned faults) {
+    gfaults = faults;
+}
+
+static int fault(unsigned kind, const char *site, const void *caller) {
+    if((gfaults & kind) && toaster_check_once_from(site, caller)) {
+        TOASTER_LOG("net fault: %s", site);
+        return 1;
+    }
+    return 0;
+}
+
+/** reordered datagrams are held back until the next one to the same socket */
+static int deliver(struct sock *to, struct dgram *d, const void *caller) {
+    struct dgram *late;
+    struct dgram *dup = 0;
+    if(fault(TOASTER_NET_DROP, "net:drop", caller)) {
+        free(d);
+        return 0;
+    }
+    if(fault(TOASTER_NET_TRUNCATE, "net:truncate", caller)) {
+        d->len /= 2;
+    }
+    if(fault(TOASTER_NET_DUPLICATE, "net:duplicate", caller)) {
+        dup = malloc(sizeof(*d) + d->len);
+        if(dup) {
+            memcpy(dup, d, sizeof(*d) + d->len);
+        }
+    }
+    if(fault(TOASTER_NET_REORDER, "net:reorder", caller)) {
+        late = __atomic_exchange_n(&to->held, d, __ATOMIC_ACQ_REL);
+        d = 0;
+    } else {
+        late = __atomic_exchange_n(&to->held, 0, __ATOMIC_ACQ_REL);
+    }
+    if(d && queue_push(&to->queue, d)) {
+        free(d);
+        free(dup);
+        free(late);
+        return -1;
+    }
+    if(dup && queue_push(&to->queue, dup)) {
+        free(dup);
+    }
+    if(late && queue_push(&to->queue, late)) {
+        free(late);
+    }
+    return 0;
+}
+
+static int fake_socket(int type) {
+    int i;
+    int unused = 0;
+    for(i = 0; i < TOASTER_NET_MAX_SOCKETS; ++i) {
+        unused = 0;
+        if(__atomic_compare_exchange_n(&gsocks[i].used, &unused, 1, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            gsocks[i].nonblock = !!(type & SOCK_NONBLOCK);
+            gsocks[i].addr.len = 0;
+            gsocks[i].held = 0;
+            queue_init(&gsocks[i].queue);
+            return TOASTER_NET_FD_BASE + i;
+        }
+    }
+    errno = EMFILE;
+    return -1;
+}
+
+static int fake_bind(struct sock *s, const struct sockaddr *addr, socklen_t addrlen) {
+    struct addr a;
+    if(sun_path(addr, addrlen, &a) || s->bound) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(endpoint(&a)) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    s->addr = a;
+    __atomic_store_n(&s->bound, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static ssize_t fake_sendto(struct sock *s, const void *buf, size_t len,
+                           const struct sockaddr *dest_addr, socklen_t addrlen,
+                           const void *caller) {
+    struct addr a;
+    struct sock *to;
+    struct dgram *d;
+    if(sun_path(dest_addr, addrlen, &a)) {
+        errno = dest_addr ? EINVAL : EDESTADDRREQ;
+        return -1;
+    }
+    to = endpoint(&a);
+    if(!to) {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    d = malloc(sizeof(*d) + len);
+    if(!d) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    d->len = len;
+    d->from = s->addr;
+    memcpy(d->data, buf, len);
+    if(deliver(to, d, caller)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return len;
+}
+
+static ssize_t fake_recvfrom(struct sock *s, void *buf, size_t len, int flags,
+                             struct sockaddr *src_addr, socklen_t *addrlen) {
+    struct sockaddr_un un = {AF_UNIX};
+    struct dgram *d;
+    size_t sz;
+    int spin;
+    /** a blocking receive waits for other threads, then expires like SO_RCVTIMEO */
+    for(spin = 0; !(d = queue_pop(&s->queue)); ++spin) {
+        d = __atomic_exchange_n(&s->held, 0, __ATOMIC_ACQ_REL);
+        if(d) {
+            break;
+        }
+        if(s->nonblock || (flags & MSG_DONTWAIT) || spin == TOASTER_NET_SPIN) {
+            errno = EAGAIN;
+            return -1;
+        }
+        sched_yield();
+    }
+    sz = d->len < len ? d->len : len;
+    memcpy(buf, d->data, sz);
+    if(flags & MSG_TRUNC) {
+        sz = d->len;
+    }
+    if(src_addr && addrlen) {
+        memcpy(un.sun_path, d->from.path, d->from.len);
+        memcpy(src_addr, &un, *addrlen < sizeof(un) ? *addrlen : sizeof(un));
+        *addrlen = offsetof(struct sockaddr_un, sun_path) + d->from.len +
+                   (d->from.len && d->from.path[0] && d->from.len < PATH);
+    }
+    free(d);
+    return sz;
+}
+
+/** mock for socket */
+int socket(int domain, int type, int protocol) {
+    int (*real)(int domain, int type, int protocol) = dlsym(RTLD_NEXT, "socket");
+    if(!toaster_check_from("socket", TOASTER_CALLER)) {
+        if(gfake && domain == AF_UNIX && (type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) == SOCK_DGRAM) {
+            return fake_socket(type);
+        }
+        return real(domain, type, protocol);
+    }
+    TOASTER_LOG("mock failure: socket");
+    TOASTER_ERRNO(socket_errnos);
+    return -1;
+}
+
+/** mock for bind */
+int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+    int (*real)(int, const struct sockaddr *, socklen_t) = dlsym(RTLD_NEXT, "bind");
+    struct sock *s;
+    if(!toaster_check_from("bind", TOASTER_CALLER)) {
+        s = fake(sockfd);
+        if(s) {
+            return fake_bind(s, addr, addrlen);
+        }
+        return real(sockfd, addr, addrlen);
+    }
+    TOASTER_LOG("mock failure: bind");
+    TOASTER_ERRNO(bind_errnos);
+    return -1;
+}
+
+/** mock for sendto */
+ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
+               const struct sockaddr *dest_addr, socklen_t addrlen) {
+    ssize_t (*real)(int, const void *, size_t, int, const struct sockaddr *, socklen_t) =
+        dlsym(RTLD_NEXT, "sendto");
+    struct sock *s;
+    if(!toaster_check_from("sendto", TOASTER_CALLER)) {
+        s = fake(sockfd);
+        if(s) {
+            return fake_sendto(s, buf, len, dest_addr, addrlen, TOASTER_CALLER);
+        }
+        return real(sockfd, buf, len, flags, dest_addr, addrlen);
+    }
+    TOASTER_LOG("mock failure: sendto");
+    TOASTER_ERRNO(sendto_errnos);
+    return -1;
+}
+
+/** mock for recvfrom */
+ssize_t recvfrom(int sockfd, void *restrict buf, size_t len, int flags,
+                 struct sockaddr *restrict src_addr, socklen_t *restrict addrlen) {
+    ssize_t (*real)(int, void *restrict, size_t, int, struct sockaddr *restrict,
+                    socklen_t *restrict) = dlsym(RTLD_NEXT, "recvfrom");
+    struct sock *s;
+    if(!toaster_check_from("recvfrom", TOASTER_CALLER)) {
+        s = fake(sockfd);
+        if(s) {
+            return fake_recvfrom(s, buf, len, flags, src_addr, addrlen);
+        }
+        return real(sockfd, buf, len, flags, src_addr, addrlen);
+    }
+    TOASTER_LOG("mock failure: recvfrom");
+    TOASTER_ERRNO(recvfrom_errnos);
+    return -1;
+}
+
+/** mock for close, never fails */
+int close(int fd) {
+    int (*real)(int) = dlsym(RTLD_NEXT, "close");
+    struct sock *s = fake(fd);
+    if(s) {
+        release(s);
+        return 0;
+    }
+    return real(fd);
+}
@@ -0,0 +1,167 @@
+/**
+ * toaster_new.cpp
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define TOASTER_SHOW_LOG
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include "toaster.h"
+
+/**
+ * replacements for every global operator new and delete
+ * blocks come from malloc and posix_memalign, so toaster_malloc.o counts them too
+ */
+
+static int gfaults;
+static long long glive;
+
+void toaster_new_faults(int on) {
+    gfaults = on;
+}
+
+long long toaster_new_live(void) {
+    return __atomic_load_n(&glive, __ATOMIC_RELAXED);
+}
+
+/**
+ * an injected failure throws without calling the new handler, which would retry
+ * a check that keeps failing until the iteration ends
+ */
+static void *allocate(std::size_t size, std::size_t align, const void *caller) {
+    void *p = nullptr;
+    if(gfaults && toaster_check_from("operator new", caller)) {
+        TOASTER_LOG("mock failure: operator new");
+        throw std::bad_alloc();
+    }
+    size = size ? size : 1;
+    for(;;) {
+        if(align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            p = std::malloc(size);
+        } else if(posix_memalign(&p, align, size)) {
+            p = nullptr;
+        }
+        if(p) {
+            __atomic_add_fetch(&glive, (long long)malloc_usable_size(p), __ATOMIC_RELAXED);
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if(!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void *allocate_nothrow(std::size_t size, std::size_t align, const void *caller) noexcept {
+    try {
+        return allocate(size, align, caller);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+static void deallocate(void *p) noexcept {
+    if(p) {
+        __atomic_sub_fetch(&glive, (long long)malloc_usable_size(p), __ATOMIC_RELAXED);
+        std::free(p);
+    }
+}
+
+void *operator new(std::size_t size) {
+    return allocate(size, 0, TOASTER_CALLER);
+}
+
+void *operator new[](std::size_t size) {
+    return allocate(size, 0, TOASTER_CALLER);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate_nothrow(size, 0, TOASTER_CALLER);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate_nothrow(size, 0, TOASTER_CALLER);
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+    return allocate(size, static_cast<std::size_t>(align), TOASTER_CALLER);
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+    return allocate(size, static_cast<std::size_t>(align), TOASTER_CALLER);
+}
+
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return allocate_nothrow(size, static_cast<std::size_t>(align), TOASTER_CALLER);
+}
+
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return allocate_nothrow(size, static_cast<std::size_t>(align), TOASTER_CALLER);
+}
+
+void operator delete(void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    deallocate(p);
+}
@@ -0,0 +1,237 @@
+/**
+ * toaster_poll.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include "toaster.h"
+
+/**
+ * under virtual time a timeout is a zero timeout probe, if nothing is ready
+ * the virtual clock jumps by the timeout instead of blocking
+ * infinite timeouts still block for real
+ *
+ * event loop faults are one shot: a failed wait, a spurious event for a
+ * registered fd that is not ready, or a ready event that is left out,
+ * which loses the edge of an EPOLLET registration
+ *
+ * close() drops an fd from its epoll sets without an EPOLL_CTL_DEL, so before
+ * a registration is reported as spurious it is looked up in the kernel's
+ * /proc/self/fdinfo of the epfd, and stale ones are forgotten
+ */
+
+struct reg {
+    int epfd;
+    int fd;
+    struct epoll_event ev;
+};
+
+static int gfaults;
+static struct reg gregs[TOASTER_POLL_MAX];
+static int gregs_len;
+
+static const int poll_errnos[] = {EINTR, ENOMEM, EINVAL};
+static const int epoll_wait_errnos[] = {EINTR, EBADF, EINVAL};
+static const int epoll_ctl_errnos[] = {ENOMEM, ENOSPC, EEXIST, ENOENT, EBADF, EINVAL, EPERM};
+
+static void reset(void) {
+    gregs_len = 0;
+}
+
+static void __attribute__((constructor)) init(void) {
+    toaster_on_reset(reset);
+}
+
+void toaster_poll_faults(int on) {
+    gfaults = on;
+}
+
+static struct reg *reg(int epfd, int fd) {
+    int i;
+    for(i = 0; i < gregs_len; ++i) {
+        if(gregs[i].epfd == epfd && gregs[i].fd == fd) {
+            return &gregs[i];
+        }
+    }
+    return 0;
+}
+
+static int fault(const char *site, const void *caller) {
+    if(gfaults && toaster_check_once_from(site, caller)) {
+        TOASTER_LOG("poll fault: %s", site);
+        return 1;
+    }
+    return 0;
+}
+
+/** mock for poll */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    int (*real)(struct pollfd *, nfds_t, int) = dlsym(RTLD_NEXT, "poll");
+    int rv;
+    nfds_t i;
+    if(fault("poll:fail", TOASTER_CALLER)) {
+        TOASTER_ERRNO(poll_errnos);
+        return -1;
+    }
+    if(!toaster_vtime_enabled() || timeout <= 0) {
+        rv = real(fds, nfds, timeout);
+    } else {
+        rv = real(fds, nfds, 0);
+        if(!rv) {
+            toaster_vtime_advance(timeout * 1000000LL);
+        }
+    }
+    for(i = 0; rv > 0 && i < nfds && !fds[i].revents; ++i) {
+    }
+    if(rv > 0 && fault("poll:lost", TOASTER_CALLER)) {
+        fds[i].revents = 0;
+        --rv;
+    }
+    for(i = 0; rv >= 0 && i < nfds && (fds[i].fd < 0 || fds[i].revents ||
+                                       !(fds[i].events & (POLLIN | POLLOUT))); ++i) {
+    }
+    if(rv >= 0 && i < nfds && fault("poll:spurious", TOASTER_CALLER)) {
+        fds[i].revents = fds[i].events & (POLLIN | POLLOUT);
+        ++rv;
+    }
+    return rv;
+}
+
+/** mock for epoll_ctl, keeps the registrations spurious events are picked from */
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    int (*real)(int, int, int, struct epoll_event *) = dlsym(RTLD_NEXT, "epoll_ctl");
+    struct reg *r;
+    int rv;
+    if(gfaults && toaster_check_from("epoll_ctl", TOASTER_CALLER)) {
+        TOASTER_LOG("mock failure: epoll_ctl");
+        TOASTER_ERRNO(epoll_ctl_errnos);
+        return -1;
+    }
+    rv = real(epfd, op, fd, event);
+    r = reg(epfd, fd);
+    if(!rv && op == EPOLL_CTL_DEL && r) {
+        *r = gregs[--gregs_len];
+    } else if(!rv && op != EPOLL_CTL_DEL) {
+        if(!r && gregs_len < TOASTER_POLL_MAX) {
+            r = &gregs[gregs_len++];
+        }
+        if(r) {
+            r->epfd = epfd;
+            r->fd = fd;
+            r->ev = *event;
+        }
+    }
+    return rv;
+}
+
+static int reported(struct epoll_event *events, int n, const struct reg *r) {
+    int i;
+    for(i = 0; i < n; ++i) {
+        if(events[i].data.u64 == r->ev.data.u64) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** the kernel still watches r, a closed or reused fd or epfd is not in its fdinfo */
+static int registered(const struct reg *r) {
+    char buf[32768], *line;
+    unsigned long long data;
+    unsigned events;
+    int fd, n, found = 0;
+    snprintf(buf, sizeof(buf), "/proc/self/fdinfo/%d", r->epfd);
+    fd = open(buf, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = 0;
+    for(line = strstr(buf, "tfd:"); !found && line; line = strstr(line + 1, "tfd:")) {
+        found = sscanf(line, "tfd: %d events: %x data: %llx", &fd, &events, &data) == 3 &&
+                fd == r->fd && data == r->ev.data.u64;
+    }
+    return found;
+}
+
+/** mock for epoll_wait */
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    int (*real)(int, struct epoll_event *, int, int) = dlsym(RTLD_NEXT, "epoll_wait");
+    int rv, i;
+    if(fault("epoll_wait:fail", TOASTER_CALLER)) {
+        TOASTER_ERRNO(epoll_wait_errnos);
+        return -1;
+    }
+    if(!toaster_vtime_enabled() || timeout <= 0) {
+        rv = real(epfd, events, maxevents, timeout);
+    } else {
+        rv = real(epfd, events, maxevents, 0);
+        if(!rv) {
+            toaster_vtime_advance(timeout * 1000000LL);
+        }
+    }
+    if(rv > 0 && fault("epoll_wait:lost", TOASTER_CALLER)) {
+        events[0] = events[--rv];
+    }
+    for(i = 0; rv >= 0 && rv < maxevents && i < gregs_len; ++i) {
+        if(gregs[i].epfd != epfd || reported(events, rv, &gregs[i])) {
+            continue;
+        }
+        if(!gfaults || registered(&gregs[i])) {
+            break;
+        }
+        gregs[i--] = gregs[--gregs_len];
+    }
+    if(rv >= 0 && rv < maxevents && i < gregs_len && fault("epoll_wait:spurious", TOASTER_CALLER)) {
+        events[rv].events = gregs[i].ev.events & (EPOLLIN | EPOLLOUT);
+        events[rv].data = gregs[i].ev.data;
+        ++rv;
+    }
+    return rv;
+}
+
+/** mock for select */
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+           struct timeval *timeout) {
+    int (*real)(int, fd_set *, fd_set *, fd_set *, struct timeval *) = dlsym(RTLD_NEXT, "select");
+    struct timeval zero = {0, 0};
+    int rv;
+    if(!toaster_vtime_enabled() || !timeout) {
+        return real(nfds, readfds, writefds, exceptfds, timeout);
+    }
+    rv = real(nfds, readfds, writefds, exceptfds, &zero);
+    if(!rv) {
+        toaster_vtime_advance(timeout->tv_sec * 1000000000LL + timeout->tv_usec * 1000LL);
+        timeout->tv_sec = 0;
+        timeout->tv_usec = 0;
+    }
+    return rv;
+}
@@ -0,0 +1,114 @@
+/**
+ * toaster_rlimit.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "toaster.h"
+
+/** open fds, counted before the limit is set and after it is lifted again */
+static int fds(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    int n = 0;
+    if(!dir) {
+        return -1;
+    }
+    while(readdir(dir)) {
+        ++n;
+    }
+    closedir(dir);
+    return n;
+}
+
+/**
+ * run the test in this child with the soft limit at `lim`
+ * the limit is lifted before exit so coverage and stdio can still be flushed
+ */
+static void child(int resource, long long lim, int (*test)(void)) {
+    struct rlimit old, tight;
+    int before, after, err;
+    toaster_coverage_worker();
+    toaster_end();
+    if(resource == RLIMIT_FSIZE) {
+        signal(SIGXFSZ, SIG_IGN);
+    }
+    before = fds();
+    if(getrlimit(resource, &old)) {
+        exit(2);
+    }
+    tight = old;
+    tight.rlim_cur = (rlim_t)lim;
+    if(old.rlim_max != RLIM_INFINITY && tight.rlim_cur > old.rlim_max) {
+        tight.rlim_cur = old.rlim_max;
+    }
+    if(setrlimit(resource, &tight)) {
+        exit(2);
+    }
+    err = test();
+    setrlimit(resource, &old);
+    after = fds();
+    if(after > before) {
+        TOASTER_LOG("rlimit %d: %lld leaked %d fds", resource, lim, after - before);
+        exit(3);
+    }
+    exit(err ? 1 : 0);
+}
+
+long long toaster_rlimit_run_range(int resource, long long min, long long max, long long step,
+                                   int (*test)(void)) {
+    long long lim;
+    int status;
+    int broken = 0;
+    pid_t pid;
+    if(step <= 0) {
+        step = 1;
+    }
+    for(lim = min; lim <= max; lim += step) {
+        TOASTER_LOG("rlimit %d: %lld", resource, lim);
+        fflush(NULL);
+        pid = fork();
+        if(pid == 0) {
+            child(resource, lim, test);
+        }
+        if(pid < 0 || waitpid(pid, &status, 0) != pid) {
+            TOASTER_LOG("fork failed: %d", errno);
+            return -1;
+        }
+        if(WIFSIGNALED(status)) {
+            TOASTER_LOG("rlimit %d: %lld died: signal %d", resource, lim, WTERMSIG(status));
+            broken = 1;
+        } else if(WEXITSTATUS(status) > 1) {
+            broken = 1;
+        } else if(!WEXITSTATUS(status)) {
+            TOASTER_LOG("rlimit %d: survived at %lld", resource, lim);
+            return broken ? -1 : lim;
+        }
+    }
+    return -1;
+}
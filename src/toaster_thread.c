@@ -0,0 +1,236 @@
+/**
+ * toaster_thread.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include "toaster.h"
+
+struct start {
+    void *(*routine)(void *);
+    void *arg;
+};
+
+static int gfaults;
+static int glimit = -1;
+static int glive;
+
+static const int pthread_create_errnos[] = {EAGAIN, EINVAL, EPERM};
+static const int pthread_mutex_init_errnos[] = {ENOMEM, EAGAIN, EPERM, EBUSY, EINVAL};
+static const int pthread_cond_init_errnos[] = {ENOMEM, EAGAIN, EBUSY, EINVAL};
+static const int pthread_attr_init_errnos[] = {ENOMEM};
+static const int pthread_attr_set_errnos[] = {EINVAL};
+static const int sem_init_errnos[] = {EINVAL, ENOSYS};
+static const int sem_open_errnos[] = {EMFILE, ENFILE, ENOMEM, ENOSPC, EACCES, EEXIST, ENOENT};
+static const int sem_wait_errnos[] = {EINTR};
+static const int sem_timedwait_errnos[] = {ETIMEDOUT, EINTR};
+static const int sem_post_errnos[] = {EOVERFLOW};
+
+void toaster_thread_faults(int on) {
+    gfaults = on;
+}
+
+void toaster_thread_limit(int max) {
+    glimit = max;
+}
+
+int toaster_thread_live(void) {
+    return __atomic_load_n(&glive, __ATOMIC_RELAXED);
+}
+
+static int check(const char *site, const void *caller) {
+    if(gfaults && toaster_check_from(site, caller)) {
+        TOASTER_LOG("mock failure: %s", site);
+        return -1;
+    }
+    return 0;
+}
+
+static void exited(void *unused) {
+    __atomic_sub_fetch(&glive, 1, __ATOMIC_RELAXED);
+}
+
+static void *trampoline(void *p) {
+    struct start start = *(struct start *)p;
+    void *rv;
+    free(p);
+    pthread_cleanup_push(exited, 0);
+    rv = start.routine(start.arg);
+    pthread_cleanup_pop(1);
+    return rv;
+}
+
+/** mock for pthread_create, counts live threads against toaster_thread_limit */
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*routine)(void *), void *arg) {
+    int (*real)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *) =
+        dlsym(RTLD_NEXT, "pthread_create");
+    struct start *start;
+    int rv;
+    if(check("pthread_create", TOASTER_CALLER)) {
+        return TOASTER_ERRNO(pthread_create_errnos);
+    }
+    if(__atomic_add_fetch(&glive, 1, __ATOMIC_RELAXED) > glimit && glimit >= 0) {
+        __atomic_sub_fetch(&glive, 1, __ATOMIC_RELAXED);
+        TOASTER_LOG("thread limit: %d", glimit);
+        toaster_injected("pthread_create");
+        return EAGAIN;
+    }
+    start = malloc(sizeof(*start));
+    if(!start) {
+        __atomic_sub_fetch(&glive, 1, __ATOMIC_RELAXED);
+        return EAGAIN;
+    }
+    start->routine = routine;
+    start->arg = arg;
+    rv = real(thread, attr, trampoline, start);
+    if(rv) {
+        __atomic_sub_fetch(&glive, 1, __ATOMIC_RELAXED);
+        free(start);
+    }
+    return rv;
+}
+
+/** mock for pthread_mutex_init */
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr) {
+    int (*real)(pthread_mutex_t *, const pthread_mutexattr_t *) =
+        dlsym(RTLD_NEXT, "pthread_mutex_init");
+    if(check("pthread_mutex_init", TOASTER_CALLER)) {
+        return TOASTER_ERRNO(pthread_mutex_init_errnos);
+    }
+    return real(mutex, attr);
+}
+
+/** mock for pthread_cond_init, the default version is the one after the 2.3.2 rewrite */
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+    int (*real)(pthread_cond_t *, const pthread_condattr_t *) =
+        dlvsym(RTLD_NEXT, "pthread_cond_init", "GLIBC_2.3.2");
+    if(!real) {
+        real = dlsym(RTLD_NEXT, "pthread_cond_init");
+    }
+    if(check("pthread_cond_init", TOASTER_CALLER)) {
+        return TOASTER_ERRNO(pthread_cond_init_errnos);
+    }
+    return real(cond, attr);
+}
+
+/** mock for pthread_attr_init */
+int pthread_attr_init(pthread_attr_t *attr) {
+    int (*real)(pthread_attr_t *) = dlsym(RTLD_NEXT, "pthread_attr_init");
+    if(check("pthread_attr_init", TOASTER_CALLER)) {
+        return TOASTER_ERRNO(pthread_attr_init_errnos);
+    }
+    return real(attr);
+}
+
+/** mock for pthread_attr_setstacksize */
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize) {
+    int (*real)(pthread_attr_t *, size_t) = dlsym(RTLD_NEXT, "pthread_attr_setstacksize");
+    if(check("pthread_attr_setstacksize", TOASTER_CALLER)) {
+        return TOASTER_ERRNO(pthread_attr_set_errnos);
+    }
+    return real(attr, stacksize);
+}
+
+/** mock for pthread_attr_setguardsize */
+int pthread_attr_setguardsize(pthread_attr_t *attr, size_t guardsize) {
+    int (*real)(pthread_attr_t *, size_t) = dlsym(RTLD_NEXT, "pthread_attr_setguardsize");
+    if(check("pthread_attr_setguardsize", TOASTER_CALLER)) {
+        return TOASTER_ERRNO(pthread_attr_set_errnos);
+    }
+    return real(attr, guardsize);
+}
+
+/** mock for pthread_attr_setdetachstate */
+int pthread_attr_setdetachstate(pthread_attr_t *attr, int detachstate) {
+    int (*real)(pthread_attr_t *, int) = dlsym(RTLD_NEXT, "pthread_attr_setdetachstate");
+    if(check("pthread_attr_setdetachstate", TOASTER_CALLER)) {
+        return TOASTER_ERRNO(pthread_attr_set_errnos);
+    }
+    return real(attr, detachstate);
+}
+
+/** mock for sem_init */
+int sem_init(sem_t *sem, int pshared, unsigned int value) {
+    int (*real)(sem_t *, int, unsigned int) = dlsym(RTLD_NEXT, "sem_init");
+    if(check("sem_init", TOASTER_CALLER)) {
+        TOASTER_ERRNO(sem_init_errnos);
+        return -1;
+    }
+    return real(sem, pshared, value);
+}
+
+/** mock for sem_open */
+sem_t *sem_open(const char *name, int oflag, ...) {
+    sem_t *(*real)(const char *, int, ...) = dlsym(RTLD_NEXT, "sem_open");
+    mode_t mode = 0;
+    unsigned int value = 0;
+    va_list ap;
+    if(check("sem_open", TOASTER_CALLER)) {
+        TOASTER_ERRNO(sem_open_errnos);
+        return SEM_FAILED;
+    }
+    if(oflag & O_CREAT) {
+        va_start(ap, oflag);
+        mode = va_arg(ap, mode_t);
+        value = va_arg(ap, unsigned int);
+        va_end(ap);
+    }
+    return real(name, oflag, mode, value);
+}
+
+/** mock for sem_wait */
+int sem_wait(sem_t *sem) {
+    int (*real)(sem_t *) = dlsym(RTLD_NEXT, "sem_wait");
+    if(check("sem_wait", TOASTER_CALLER)) {
+        TOASTER_ERRNO(sem_wait_errnos);
+        return -1;
+    }
+    return real(sem);
+}
+
+/** mock for sem_timedwait */
+int sem_timedwait(sem_t *restrict sem, const struct timespec *restrict abs_timeout) {
+    int (*real)(sem_t *restrict, const struct timespec *restrict) =
+        dlsym(RTLD_NEXT, "sem_timedwait");
+    if(check("sem_timedwait", TOASTER_CALLER)) {
+        TOASTER_ERRNO(sem_timedwait_errnos);
+        return -1;
+    }
+    return real(sem, abs_timeout);
+}
+
+/** mock for sem_post */
+int sem_post(sem_t *sem) {
+    int (*real)(sem_t *) = dlsym(RTLD_NEXT, "sem_post");
+    if(check("sem_post", TOASTER_CALLER)) {
+        TOASTER_ERRNO(sem_post_errnos);
+        return -1;
+    }
+    return real(sem);
+}
@@ -0,0 +1,164 @@
+/**
+ * toaster_time.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "toaster.h"
+
+#define NSEC 1000000000LL
+
+static int genabled;
+static long long grealtime;
+static long long gmonotonic;
+static long long gnow;
+
+static long long real_ns(clockid_t clk) {
+    int (*real)(clockid_t, struct timespec *) = dlsym(RTLD_NEXT, "clock_gettime");
+    struct timespec ts;
+    real(clk, &ts);
+    return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+static void reset(void) {
+    __atomic_store_n(&gnow, 0, __ATOMIC_RELAXED);
+}
+
+static void __attribute__((constructor)) init(void) {
+    toaster_on_reset(reset);
+}
+
+void toaster_vtime_enable(int on) {
+    grealtime = real_ns(CLOCK_REALTIME);
+    gmonotonic = real_ns(CLOCK_MONOTONIC);
+    reset();
+    genabled = on;
+}
+
+int toaster_vtime_enabled(void) {
+    return genabled;
+}
+
+long long toaster_vtime_ns(void) {
+    return __atomic_load_n(&gnow, __ATOMIC_RELAXED);
+}
+
+void toaster_vtime_advance(long long ns) {
+    if(ns > 0) {
+        __atomic_add_fetch(&gnow, ns, __ATOMIC_RELAXED);
+    }
+}
+
+static void to_timespec(long long ns, struct timespec *ts) {
+    ts->tv_sec = ns / NSEC;
+    ts->tv_nsec = ns % NSEC;
+}
+
+/** mock for clock_gettime, cpu time clocks stay real */
+int clock_gettime(clockid_t clk, struct timespec *ts) {
+    int (*real)(clockid_t, struct timespec *) = dlsym(RTLD_NEXT, "clock_gettime");
+    if(!genabled) {
+        return real(clk, ts);
+    }
+    switch(clk) {
+    case CLOCK_REALTIME:
+    case CLOCK_REALTIME_COARSE:
+        to_timespec(grealtime + toaster_vtime_ns(), ts);
+        return 0;
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_COARSE:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_BOOTTIME:
+        to_timespec(gmonotonic + toaster_vtime_ns(), ts);
+        return 0;
+    default:
+        return real(clk, ts);
+    }
+}
+
+/** mock for gettimeofday */
+int gettimeofday(struct timeval *restrict tv, void *restrict tz) {
+    int (*real)(struct timeval *restrict, void *restrict) = dlsym(RTLD_NEXT, "gettimeofday");
+    long long ns;
+    if(!genabled) {
+        return real(tv, tz);
+    }
+    ns = grealtime + toaster_vtime_ns();
+    tv->tv_sec = ns / NSEC;
+    tv->tv_usec = (ns % NSEC) / 1000;
+    return 0;
+}
+
+/** mock for nanosleep */
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+    int (*real)(const struct timespec *, struct timespec *) = dlsym(RTLD_NEXT, "nanosleep");
+    if(!genabled) {
+        return real(req, rem);
+    }
+    if(req->tv_nsec < 0 || req->tv_nsec >= NSEC || req->tv_sec < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    toaster_vtime_advance(req->tv_sec * NSEC + req->tv_nsec);
+    return 0;
+}
+
+/** mock for clock_nanosleep */
+int clock_nanosleep(clockid_t clk, int flags, const struct timespec *req, struct timespec *rem) {
+    int (*real)(clockid_t, int, const struct timespec *, struct timespec *) =
+        dlsym(RTLD_NEXT, "clock_nanosleep");
+    struct timespec now;
+    if(!genabled) {
+        return real(clk, flags, req, rem);
+    }
+    if(!(flags & TIMER_ABSTIME)) {
+        return nanosleep(req, rem) ? errno : 0;
+    }
+    if(clock_gettime(clk, &now)) {
+        return errno;
+    }
+    toaster_vtime_advance((req->tv_sec - now.tv_sec) * NSEC + (req->tv_nsec - now.tv_nsec));
+    return 0;
+}
+
+/** mock for usleep */
+int usleep(useconds_t us) {
+    int (*real)(useconds_t) = dlsym(RTLD_NEXT, "usleep");
+    if(!genabled) {
+        return real(us);
+    }
+    toaster_vtime_advance(us * 1000LL);
+    return 0;
+}
+
+/** mock for sleep */
+unsigned int sleep(unsigned int seconds) {
+    unsigned int (*real)(unsigned int) = dlsym(RTLD_NEXT, "sleep");
+    if(!genabled) {
+        return real(seconds);
+    }
+    toaster_vtime_advance(seconds * NSEC);
+    return 0;
+}
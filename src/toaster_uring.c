@@ -0,0 +1,165 @@
+/**
+ * toaster_uring.c
+ *
+ * Copyright (c) 2017 <Anatoly Yakovenko> aeyakovenko@gmail.com
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#define TOASTER_SHOW_LOG
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <linux/io_uring.h>
+#include "toaster.h"
+
+/**
+ * mocks for the calls liburing exports, the ring itself stays opaque so
+ * liburing headers are not needed to build this
+ * completions liburing only peeks inline can be passed to toaster_uring_cqe
+ */
+struct io_uring;
+
+static unsigned gfaults;
+static struct io_uring_cqe *glast;
+
+static const int submit_errnos[] = {EAGAIN, EBUSY, EINTR, ENOMEM};
+static const int wait_errnos[] = {EINTR, EAGAIN, ETIME};
+static const int cqe_errnos[] = {EIO, ECANCELED, EAGAIN, EINTR, ENOBUFS, ETIME};
+
+void toaster_uring_faults(unsigned faults) {
+    gfaults = faults;
+    glast = 0;
+}
+
+/** a ring on the stack is at the same address every iteration, and so are its cqes */
+static void reset(void) {
+    glast = 0;
+}
+
+static void __attribute__((constructor)) init(void) {
+    toaster_on_reset(reset);
+}
+
+static int check(const char *site, const void *caller) {
+    if((gfaults & TOASTER_URING_ERRORS) && toaster_check_from(site, caller)) {
+        TOASTER_LOG("mock failure: %s", site);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * a rewritten completion is a one shot fault, so the recovery that follows is swept too
+ * only byte counts can come back short, which the caller vouches for with TOASTER_URING_SHORT
+ */
+static int rewrite(struct io_uring_cqe *cqe, const void *caller) {
+    if(!gfaults || !cqe || cqe == glast) {
+        return 0;
+    }
+    glast = cqe;
+    if((gfaults & TOASTER_URING_SHORT) && cqe->res > 1 &&
+       toaster_check_once_from("io_uring_cqe:short", caller)) {
+        TOASTER_LOG("short completion: %d", cqe->res / 2);
+        cqe->res /= 2;
+        return 1;
+    }
+    if((gfaults & TOASTER_URING_ERRORS) && toaster_check_once_from("io_uring_cqe:error", caller)) {
+        cqe->res = -TOASTER_ERRNO(cqe_errnos);
+        TOASTER_LOG("failed completion: %d", cqe->res);
+        return 1;
+    }
+    return 0;
+}
+
+int toaster_uring_cqe(struct io_uring_cqe *cqe) {
+    return rewrite(cqe, TOASTER_CALLER);
+}
+
+/** mock for io_uring_enter */
+int io_uring_enter(unsigned int fd, unsigned int to_submit, unsigned int min_complete,
+                   unsigned int flags, sigset_t *sig) {
+    int (*real)(unsigned int, unsigned int, unsigned int, unsigned int, sigset_t *) =
+        dlsym(RTLD_NEXT, "io_uring_enter");
+    if(check("io_uring_enter", TOASTER_CALLER)) {
+        return -TOASTER_ERRNO(submit_errnos);
+    }
+    return real ? real(fd, to_submit, min_complete, flags, sig) : -ENOSYS;
+}
+
+/** mock for io_uring_submit */
+int io_uring_submit(struct io_uring *ring) {
+    int (*real)(struct io_uring *) = dlsym(RTLD_NEXT, "io_uring_submit");
+    if(check("io_uring_submit", TOASTER_CALLER)) {
+        return -TOASTER_ERRNO(submit_errnos);
+    }
+    return real ? real(ring) : -ENOSYS;
+}
+
+/** mock for io_uring_submit_and_wait */
+int io_uring_submit_and_wait(struct io_uring *ring, unsigned wait_nr) {
+    int (*real)(struct io_uring *, unsigned) = dlsym(RTLD_NEXT, "io_uring_submit_and_wait");
+    if(check("io_uring_submit_and_wait", TOASTER_CALLER)) {
+        return -TOASTER_ERRNO(submit_errnos);
+    }
+    return real ? real(ring, wait_nr) : -ENOSYS;
+}
+
+/** mock for __io_uring_get_cqe, what io_uring_wait_cqe and io_uring_peek_cqe fall back to */
+int __io_uring_get_cqe(struct io_uring *ring, struct io_uring_cqe **cqe_ptr,
+                       unsigned submit, unsigned wait_nr, sigset_t *sigmask) {
+    int (*real)(struct io_uring *, struct io_uring_cqe **, unsigned, unsigned, sigset_t *) =
+        dlsym(RTLD_NEXT, "__io_uring_get_cqe");
+    int rv;
+    if(check("io_uring_wait_cqe", TOASTER_CALLER)) {
+        return -TOASTER_ERRNO(wait_errnos);
+    }
+    rv = real ? real(ring, cqe_ptr, submit, wait_nr, sigmask) : -ENOSYS;
+    if(!rv) {
+        rewrite(*cqe_ptr, TOASTER_CALLER);
+    }
+    return rv;
+}
+
+/** mock for io_uring_wait_cqes */
+int io_uring_wait_cqes(struct io_uring *ring, struct io_uring_cqe **cqe_ptr, unsigned wait_nr,
+                       struct __kernel_timespec *ts, sigset_t *sigmask) {
+    int (*real)(struct io_uring *, struct io_uring_cqe **, unsigned,
+                struct __kernel_timespec *, sigset_t *) = dlsym(RTLD_NEXT, "io_uring_wait_cqes");
+    int rv;
+    if(check("io_uring_wait_cqes", TOASTER_CALLER)) {
+        return -TOASTER_ERRNO(wait_errnos);
+    }
+    rv = real ? real(ring, cqe_ptr, wait_nr, ts, sigmask) : -ENOSYS;
+    if(!rv) {
+        rewrite(*cqe_ptr, TOASTER_CALLER);
+    }
+    return rv;
+}
+
+/** mock for io_uring_peek_batch_cqe */
+unsigned io_uring_peek_batch_cqe(struct io_uring *ring, struct io_uring_cqe **cqes,
+                                 unsigned count) {
+    unsigned (*real)(struct io_uring *, struct io_uring_cqe **, unsigned) =
+        dlsym(RTLD_NEXT, "io_uring_peek_batch_cqe");
+    unsigned i, n = real ? real(ring, cqes, count) : 0;
+    for(i = 0; i < n; ++i) {
+        rewrite(cqes[i], TOASTER_CALLER);
+    }
+    return n;
+}